@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <string>
 #include <cmath> // expf
 #include <unordered_map>
@@ -53,13 +54,16 @@ public:
   }
   virtual void apply(float* data, long size) {}
 
+  // Safe to call from several threads at once (e.g. while loading models in parallel). "Tanh" resolves to the fast
+  // approximation while it's enabled.
   static Activation* get_activation(const std::string name);
   static void enable_fast_tanh();
   static void disable_fast_tanh();
-  static bool using_fast_tanh;
+  static std::atomic<bool> using_fast_tanh;
 
 protected:
-  static std::unordered_map<std::string, Activation*> _activations;
+  // Never modified after static initialization
+  static const std::unordered_map<std::string, Activation*> _activations;
 };
 
 class ActivationTanh : public Activation
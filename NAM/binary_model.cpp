@@ -0,0 +1,169 @@
+#include <bit>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <vector>
+
+#include "binary_model.h"
+#include "json.hpp"
+
+namespace
+{
+void check_endianness()
+{
+  if constexpr (std::endian::native != std::endian::little)
+    throw std::runtime_error("Binary models are only supported on little-endian platforms");
+}
+
+// The header of a binary model held in memory, once it's been checked
+nam::binary_model::Header read_header(const char* data, const size_t size)
+{
+  using namespace nam::binary_model;
+  check_endianness();
+  if (size < sizeof(Header) || !is_binary_model(data, size))
+    throw std::runtime_error("Not a binary model");
+  Header header;
+  std::memcpy(&header, data, sizeof(Header));
+  if (header.format_version != kFormatVersion)
+  {
+    std::stringstream ss;
+    ss << "Binary model is format version " << header.format_version << ", but only version " << kFormatVersion
+       << " is supported. Re-convert it from the .nam file.";
+    throw std::runtime_error(ss.str());
+  }
+  // Compare against the remaining size so that nothing here can overflow.
+  if (header.json_offset > size || header.json_size > size - header.json_offset || header.weights_offset > size
+      || header.num_weights > (size - header.weights_offset) / sizeof(float) || header.packed_offset > size
+      || header.packed_size > (size - header.packed_offset) / sizeof(float))
+    throw std::runtime_error("Corrupted binary model: sections run past the end of the file");
+  if (header.weights_offset % alignof(float) != 0 || header.packed_offset % kWeightAlignment != 0)
+    throw std::runtime_error("Corrupted binary model: misaligned weights");
+  if (header.packed_format > (uint32_t)nam::WeightFormat::kBFloat16)
+    throw std::runtime_error("Corrupted binary model: unknown weight format");
+  return header;
+}
+
+uint64_t align(const uint64_t offset)
+{
+  using nam::binary_model::kWeightAlignment;
+  return (offset + kWeightAlignment - 1) / kWeightAlignment * kWeightAlignment;
+}
+
+void write_padding(std::ostream& out, const uint64_t from, const uint64_t to)
+{
+  const std::vector<char> padding(to - from, 0);
+  out.write(padding.data(), padding.size());
+}
+}; // namespace
+
+bool nam::binary_model::is_binary_model(const std::filesystem::path& filename)
+{
+  std::ifstream file(filename, std::ios::binary);
+  char magic[sizeof(kMagic)];
+  if (!file.read(magic, sizeof(magic)))
+    return false;
+  return is_binary_model(magic, sizeof(magic));
+}
+
+bool nam::binary_model::is_binary_model(const char* data, const size_t size)
+{
+  return size >= sizeof(kMagic) && std::memcmp(data, kMagic, sizeof(kMagic)) == 0;
+}
+
+std::span<const float> nam::binary_model::parse(const char* data, const size_t size, dspData& model)
+{
+  const Header header = read_header(data, size);
+  const char* json_begin = data + header.json_offset;
+  const nlohmann::json j = nlohmann::json::parse(json_begin, json_begin + header.json_size);
+  model.version = j.at("version");
+  model.architecture = j.at("architecture");
+  model.config = j.at("config");
+  model.metadata = j.at("metadata");
+  model.expected_sample_rate = j.at("sample_rate");
+  const char* weights_begin = data + header.weights_offset;
+  if (reinterpret_cast<std::uintptr_t>(weights_begin) % alignof(float) != 0)
+  {
+    // Buffers handed to us from elsewhere needn't be aligned. Files we map always are.
+    model.weights.resize(header.num_weights);
+    std::memcpy(model.weights.data(), weights_begin, header.num_weights * sizeof(float));
+    return model.weights;
+  }
+  return std::span<const float>(reinterpret_cast<const float*>(weights_begin), header.num_weights);
+}
+
+std::span<const float> nam::binary_model::get_packed_weights(const char* data, const size_t size, WeightFormat& format)
+{
+  const Header header = read_header(data, size);
+  format = (WeightFormat)header.packed_format;
+  if (header.packed_size == 0)
+    return {};
+  return std::span<const float>(reinterpret_cast<const float*>(data + header.packed_offset), header.packed_size);
+}
+
+void nam::binary_model::save(const dspData& model, const std::filesystem::path& filename, const DSP* dsp)
+{
+  // Models loaded from `filename` may be computing with weights mapped from it, and `model` may even be one of them,
+  // so never write over it in place: write a file of our own and rename it into place once it's complete.
+  std::random_device random;
+  std::filesystem::path temp_filename = filename;
+  temp_filename += ".tmp" + std::to_string(random());
+  {
+    std::ofstream out(temp_filename, std::ios::binary | std::ios::trunc);
+    if (!out)
+      throw std::runtime_error("Failed to open " + temp_filename.string() + " for writing");
+    save(model, out, dsp);
+    out.close();
+    if (!out)
+    {
+      std::filesystem::remove(temp_filename);
+      throw std::runtime_error("Failed to write " + temp_filename.string());
+    }
+  }
+  std::error_code error;
+  std::filesystem::rename(temp_filename, filename, error);
+  if (error)
+  {
+    std::filesystem::remove(temp_filename);
+    throw std::runtime_error("Failed to move " + temp_filename.string() + " into place at " + filename.string() + ": "
+                             + error.message());
+  }
+}
+
+uint64_t nam::binary_model::save(const dspData& model, std::ostream& out, const DSP* dsp)
+{
+  check_endianness();
+  nlohmann::json j;
+  j["version"] = model.version;
+  j["architecture"] = model.architecture;
+  j["config"] = model.config;
+  j["metadata"] = model.metadata;
+  j["sample_rate"] = model.expected_sample_rate;
+  const std::string json_str = j.dump();
+  const std::span<const float> packed = dsp != nullptr ? dsp->get_packed_weights() : std::span<const float>();
+
+  Header header = {};
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.format_version = kFormatVersion;
+  header.json_offset = sizeof(Header);
+  header.json_size = json_str.size();
+  header.weights_offset = align(header.json_offset + header.json_size);
+  header.num_weights = model.weights.size();
+  const uint64_t weights_end = header.weights_offset + header.num_weights * sizeof(float);
+  header.packed_offset = packed.empty() ? 0 : align(weights_end);
+  header.packed_size = packed.size();
+  header.packed_format = (uint32_t)(dsp != nullptr ? dsp->get_weight_format() : WeightFormat::kFloat32);
+
+  out.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+  out.write(json_str.data(), json_str.size());
+  write_padding(out, header.json_offset + header.json_size, header.weights_offset);
+  out.write(reinterpret_cast<const char*>(model.weights.data()), model.weights.size() * sizeof(float));
+  if (packed.empty())
+    return weights_end;
+  write_padding(out, weights_end, header.packed_offset);
+  out.write(reinterpret_cast<const char*>(packed.data()), packed.size() * sizeof(float));
+  return header.packed_offset + header.packed_size * sizeof(float);
+}
@@ -0,0 +1,79 @@
+#pragma once
+// Binary model files (".namb")
+//
+// A faster-to-load alternative to the JSON .nam files. Layout (all integers little-endian):
+//
+//   Header (see below)
+//   JSON object with the "version", "architecture", "config", "metadata" and "sample_rate" of the model
+//   Zero padding up to a multiple of kWeightAlignment bytes
+//   The weights as little-endian float32, in the same order as the "weights" array of the .nam file
+//   Optionally, zero padding up to a multiple of kWeightAlignment bytes and the weights again, packed the way the model
+//   computes with them (see weight_arena.h)
+//
+// get_dsp() recognizes these files by their magic number and memory-maps them, so only the JSON is parsed. The
+// modules are still built from the weights in trainer order (a few values, like the LSTM's initial state, only live
+// in the modules). If the file has packed weights and they match, the model then computes with them in place, as it
+// would with shared weights (see shared_weights.h): the modules' copies are dropped and no arena is allocated, so
+// every process that loads the file shares the one copy in the page cache. Models without packed weights (like the
+// ones in model packs) pack a copy of their own.
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <ostream>
+#include <span>
+
+#include "dsp.h"
+
+namespace nam
+{
+namespace binary_model
+{
+constexpr char kMagic[4] = {'N', 'A', 'M', 'B'};
+// Bump this whenever the layout changes, or the way weights are packed.
+constexpr uint32_t kFormatVersion = 2;
+// Alignment of the weights, relative to the start of the file.
+constexpr uint64_t kWeightAlignment = 64;
+
+struct Header
+{
+  char magic[4];
+  uint32_t format_version;
+  // Where the JSON with everything but the weights lives
+  uint64_t json_offset;
+  uint64_t json_size;
+  // Where the weights live. A multiple of kWeightAlignment.
+  uint64_t weights_offset;
+  uint64_t num_weights;
+  // Where the packed weights live, if they're there (packed_size is 0 if not). A multiple of kWeightAlignment.
+  uint64_t packed_offset;
+  // In floats, including padding (half-precision matrices count two values per float)
+  uint64_t packed_size;
+  // What the packed weights' big matrices are stored as (a WeightFormat)
+  uint32_t packed_format;
+  uint32_t reserved;
+};
+static_assert(sizeof(Header) == 64, "Binary model header must not have padding");
+
+// Whether the file at `filename` starts with the binary model magic number.
+bool is_binary_model(const std::filesystem::path& filename);
+// Whether `data` starts with the binary model magic number.
+bool is_binary_model(const char* data, const size_t size);
+// Parses a binary model held in memory.
+// Everything but the weights is put in `model`; the weights are returned as a view into `data`, which must therefore
+// outlive any use of them. If `data` isn't aligned for floats, the weights are copied into `model.weights` instead
+// and the view is of those.
+std::span<const float> parse(const char* data, const size_t size, dspData& model);
+// The packed weights of a binary model held in memory that parse() accepted, as a view into `data`, and what they're
+// stored as. Empty if it has none.
+std::span<const float> get_packed_weights(const char* data, const size_t size, WeightFormat& format);
+// Writes `model` to `filename` as a binary model. If `dsp` (built from `model`) is given, its packed weights are
+// written too. The file is written under a temporary name and renamed into place, so models still mapping the old one
+// (even the one being saved) keep working.
+void save(const dspData& model, const std::filesystem::path& filename, const DSP* dsp = nullptr);
+// Same, but to a stream opened in binary mode. Offsets in the header are relative to where the stream was, so it
+// should be at a multiple of kWeightAlignment for the weights to end up aligned.
+// Returns the number of bytes written.
+uint64_t save(const dspData& model, std::ostream& out, const DSP* dsp = nullptr);
+}; // namespace binary_model
+}; // namespace nam
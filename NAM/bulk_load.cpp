@@ -0,0 +1,53 @@
+#include <algorithm>
+#include <exception>
+#include <functional>
+
+#include "bulk_load.h"
+#include "thread_pool.h"
+
+namespace
+{
+// Run load(i) for every i on a pool, catching whatever goes wrong.
+std::vector<nam::LoadResult> load_all(const size_t count, const size_t num_threads,
+                                      std::function<std::unique_ptr<nam::DSP>(size_t)> load)
+{
+  std::vector<nam::LoadResult> results(count);
+  if (count == 0)
+    return results;
+  // No point in starting more threads than there are models
+  const size_t n = std::min(num_threads > 0 ? num_threads : nam::ThreadPool::default_num_threads(), count);
+  nam::ThreadPool pool(n);
+  for (size_t i = 0; i < count; i++)
+  {
+    // Each task only writes to its own entry.
+    pool.submit([&results, &load, i]() {
+      try
+      {
+        results[i].dsp = load(i);
+      }
+      catch (const std::exception& e)
+      {
+        results[i].error = e.what();
+      }
+      catch (...)
+      {
+        results[i].error = "Unknown error";
+      }
+    });
+  }
+  pool.wait();
+  return results;
+}
+}; // namespace
+
+std::vector<nam::LoadResult> nam::get_dsps(const std::vector<std::filesystem::path>& model_files,
+                                           const size_t num_threads)
+{
+  return load_all(model_files.size(), num_threads, [&model_files](size_t i) { return get_dsp(model_files[i]); });
+}
+
+std::vector<nam::LoadResult> nam::get_dsps(const std::vector<std::span<const std::byte>>& buffers,
+                                           const size_t num_threads)
+{
+  return load_all(buffers.size(), num_threads, [&buffers](size_t i) { return get_dsp(buffers[i]); });
+}
@@ -0,0 +1,33 @@
+#pragma once
+// Loading many models at once
+//
+// Parsing, building and prewarming a model is independent of every other model, so when a tool or a server starts up
+// with a long list of models, they can be loaded side by side on a pool of threads instead of one after another.
+
+#include <cstddef>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+#include "dsp.h"
+
+namespace nam
+{
+struct LoadResult
+{
+  // nullptr if the model couldn't be loaded
+  std::unique_ptr<DSP> dsp;
+  // Why not, if it couldn't
+  std::string error;
+};
+
+// Load each model as get_dsp() would. Results are in the same order as the inputs, and a failure only affects its
+// own entry.
+// :param num_threads: Size of the pool to load on. 0 means one thread per hardware thread.
+std::vector<LoadResult> get_dsps(const std::vector<std::filesystem::path>& model_files, const size_t num_threads = 0);
+// Same, but from the contents of model files (.nam or binary) that are already in memory. The buffers only need to
+// stay alive until this returns.
+std::vector<LoadResult> get_dsps(const std::vector<std::span<const std::byte>>& buffers, const size_t num_threads = 0);
+}; // namespace nam
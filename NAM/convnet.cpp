@@ -10,7 +10,7 @@
 #include "dsp.h"
 #include "convnet.h"
 
-nam::convnet::BatchNorm::BatchNorm(const int dim, std::vector<float>::iterator& weights)
+nam::convnet::BatchNorm::BatchNorm(const int dim, weights_it& weights)
 {
   // Extract from param buffer
   Eigen::VectorXf running_mean(dim);
@@ -31,8 +31,8 @@ nam::convnet::BatchNorm::BatchNorm(const int dim, std::vector<float>::iterator&
   this->scale.resize(dim);
   this->loc.resize(dim);
   for (int i = 0; i < dim; i++)
-    this->scale(i) = _weight(i) / sqrt(eps + running_var(i));
-  this->loc = _bias - this->scale.cwiseProduct(running_mean);
+    this->scale.get_()(i) = _weight(i) / sqrt(eps + running_var(i));
+  this->loc.get_() = _bias - this->scale.get_().cwiseProduct(running_mean);
 }
 
 void nam::convnet::BatchNorm::process_(Eigen::MatrixXf& x, const long i_start, const long i_end) const
@@ -41,14 +41,29 @@ void nam::convnet::BatchNorm::process_(Eigen::MatrixXf& x, const long i_start, c
   // #speed but conv probably dominates
   for (auto i = i_start; i < i_end; i++)
   {
-    x.col(i) = x.col(i).cwiseProduct(this->scale);
-    x.col(i) += this->loc;
+    x.col(i) = x.col(i).cwiseProduct(this->scale.view());
+    x.col(i) += this->loc.view();
   }
 }
 
+void nam::convnet::BatchNorm::pack_(WeightArena& arena)
+{
+  this->scale.pack_(arena);
+  this->loc.pack_(arena);
+}
+
+void nam::convnet::BatchNorm::select_channels_(const prune::Channels& channels)
+{
+  const Eigen::MatrixXf scale = prune::select(this->scale.view(), channels, prune::all(1));
+  const Eigen::MatrixXf loc = prune::select(this->loc.view(), channels, prune::all(1));
+  this->scale.resize(channels.size());
+  this->scale.get_() = scale;
+  this->loc.resize(channels.size());
+  this->loc.get_() = loc;
+}
+
 void nam::convnet::ConvNetBlock::set_weights_(const int in_channels, const int out_channels, const int _dilation,
-                                              const bool batchnorm, const std::string activation,
-                                              std::vector<float>::iterator& weights)
+                                              const bool batchnorm, const std::string activation, weights_it& weights)
 {
   this->_batchnorm = batchnorm;
   // HACK 2 kernel
@@ -74,31 +89,78 @@ long nam::convnet::ConvNetBlock::get_out_channels() const
   return this->conv.get_out_channels();
 }
 
-nam::convnet::_Head::_Head(const int channels, std::vector<float>::iterator& weights)
+void nam::convnet::ConvNetBlock::pack_(WeightArena& arena)
+{
+  this->conv.pack_(arena);
+  if (this->_batchnorm)
+    this->batchnorm.pack_(arena);
+}
+
+bool nam::convnet::ConvNetBlock::is_dead_output_(const long c, const prune::Channels& in_channels,
+                                                 const float tolerance) const
+{
+  for (long k = 0; k < this->conv.get_kernel_size(); k++)
+    if (!prune::row_is_negligible(this->conv.get_weight(k), c, in_channels, tolerance))
+      return false;
+  // Then it's whatever zero comes out as
+  const Eigen::VectorXf bias = this->conv.get_bias();
+  const float value = this->_batchnorm ? this->batchnorm.get_loc(c) : (bias.size() > 0 ? bias(c) : 0.0f);
+  return std::abs(prune::activate(this->activation, value)) <= tolerance;
+}
+
+bool nam::convnet::ConvNetBlock::is_unread_input_(const long c, const prune::Channels& out_channels,
+                                                  const float tolerance) const
+{
+  for (long k = 0; k < this->conv.get_kernel_size(); k++)
+    if (!prune::col_is_negligible(this->conv.get_weight(k), out_channels, c, tolerance))
+      return false;
+  return true;
+}
+
+void nam::convnet::ConvNetBlock::select_channels_(const prune::Channels& out_channels,
+                                                  const prune::Channels& in_channels)
+{
+  this->conv.select_channels_(out_channels, in_channels);
+  if (this->_batchnorm)
+    this->batchnorm.select_channels_(out_channels);
+}
+
+nam::convnet::_Head::_Head(const int channels, weights_it& weights)
 {
   this->_weight.resize(channels);
   for (int i = 0; i < channels; i++)
-    this->_weight[i] = *(weights++);
+    this->_weight.get_()(i) = *(weights++);
   this->_bias = *(weights++);
 }
 
-void nam::convnet::_Head::process_(const Eigen::MatrixXf& input, Eigen::VectorXf& output, const long i_start,
-                                   const long i_end) const
+void nam::convnet::_Head::process_(const Eigen::MatrixXf& input, Eigen::Ref<Eigen::VectorXf> output,
+                                   const long i_start, const long i_end) const
 {
   const long length = i_end - i_start;
-  output.resize(length);
   for (long i = 0, j = i_start; i < length; i++, j++)
-    output(i) = this->_bias + input.col(j).dot(this->_weight);
+    output(i) = this->_bias + input.col(j).dot(this->_weight.view());
+}
+
+void nam::convnet::_Head::pack_(WeightArena& arena)
+{
+  this->_weight.pack_(arena);
+}
+
+void nam::convnet::_Head::select_channels_(const prune::Channels& channels)
+{
+  const Eigen::MatrixXf weight = prune::select(this->_weight.view(), channels, prune::all(1));
+  this->_weight.resize(channels.size());
+  this->_weight.get_() = weight;
 }
 
 nam::convnet::ConvNet::ConvNet(const int channels, const std::vector<int>& dilations, const bool batchnorm,
-                               const std::string activation, std::vector<float>& weights,
+                               const std::string activation, std::span<const float> weights,
                                const double expected_sample_rate)
 : Buffer(*std::max_element(dilations.begin(), dilations.end()), expected_sample_rate)
 {
   this->_verify_weights(channels, dilations, batchnorm, weights.size());
   this->_blocks.resize(dilations.size());
-  std::vector<float>::iterator it = weights.begin();
+  weights_it it = weights.begin();
   for (size_t i = 0; i < dilations.size(); i++)
     this->_blocks[i].set_weights_(i == 0 ? 1 : channels, channels, dilations[i], batchnorm, activation, it);
   this->_block_vals.resize(this->_blocks.size() + 1);
@@ -114,9 +176,7 @@ nam::convnet::ConvNet::ConvNet(const int channels, const std::vector<int>& dilat
     _prewarm_samples += dilations[i];
 }
 
-
-void nam::convnet::ConvNet::process(NAM_SAMPLE* input, NAM_SAMPLE* output, const int num_frames)
-
+void nam::convnet::ConvNet::_process_(const float* input, float* output, const int num_frames)
 {
   this->_update_buffers_(input, num_frames);
   // Main computation!
@@ -127,11 +187,9 @@ void nam::convnet::ConvNet::process(NAM_SAMPLE* input, NAM_SAMPLE* output, const
     this->_block_vals[0](0, i) = this->_input_buffer[i];
   for (size_t i = 0; i < this->_blocks.size(); i++)
     this->_blocks[i].process_(this->_block_vals[i], this->_block_vals[i + 1], i_start, i_end);
-  // TODO clean up this allocation
-  this->_head.process_(this->_block_vals[this->_blocks.size()], this->_head_output, i_start, i_end);
-  // Copy to required output array (TODO tighten this up)
-  for (int s = 0; s < num_frames; s++)
-    output[s] = this->_head_output(s);
+  // The head writes straight to the output.
+  this->_head.process_(
+    this->_block_vals[this->_blocks.size()], Eigen::Map<Eigen::VectorXf>(output, num_frames), i_start, i_end);
 }
 
 void nam::convnet::ConvNet::_verify_weights(const int channels, const std::vector<int>& dilations, const bool batchnorm,
@@ -140,25 +198,57 @@ void nam::convnet::ConvNet::_verify_weights(const int channels, const std::vecto
   // TODO
 }
 
-void nam::convnet::ConvNet::_update_buffers_(NAM_SAMPLE* input, const int num_frames)
+void nam::convnet::ConvNet::_update_buffers_(const float* input, const int num_frames)
 {
   this->Buffer::_update_buffers_(input, num_frames);
+  this->_resize_block_vals_();
+}
 
-  const size_t buffer_size = this->_input_buffer.size();
+void nam::convnet::ConvNet::_prepare_(const int max_num_frames)
+{
+  this->Buffer::_prepare_(max_num_frames);
+  this->_resize_block_vals_();
+  for (auto& block : this->_blocks)
+    block.conv.reserve_(max_num_frames);
+}
 
-  if (this->_block_vals[0].rows() != 1 || this->_block_vals[0].cols() != buffer_size)
-  {
-    this->_block_vals[0].resize(1, buffer_size);
-    this->_block_vals[0].setZero();
-  }
+int nam::convnet::ConvNet::_get_render_block_size_() const
+{
+  // Each block reads one set of block values and writes the next
+  long floats_per_frame = 1;
+  for (const auto& block : this->_blocks)
+    floats_per_frame = std::max(floats_per_frame, block.conv.get_in_channels() + block.get_out_channels());
+  return _fit_render_block_size(floats_per_frame);
+}
+
+long nam::convnet::ConvNet::_get_receptive_field_() const
+{
+  // The input buffer only keeps what one block needs; the blocks' outputs keep the rest.
+  long receptive_field = 1;
+  for (const auto& block : this->_blocks)
+    receptive_field += block.conv.get_dilation() * (block.conv.get_kernel_size() - 1);
+  return receptive_field;
+}
 
-  for (size_t i = 1; i < this->_block_vals.size(); i++)
+void nam::convnet::ConvNet::_resize_block_vals_()
+{
+  const long buffer_size = (long)this->_input_buffer.size();
+  for (size_t i = 0; i < this->_block_vals.size(); i++)
   {
-    if (this->_block_vals[i].rows() == this->_blocks[i - 1].get_out_channels()
-        && this->_block_vals[i].cols() == buffer_size)
+    Eigen::MatrixXf& block_vals = this->_block_vals[i];
+    const long channels = i == 0 ? 1 : this->_blocks[i - 1].get_out_channels();
+    if (block_vals.rows() == channels && block_vals.cols() == buffer_size)
       continue; // Already has correct size
-    this->_block_vals[i].resize(this->_blocks[i - 1].get_out_channels(), buffer_size);
-    this->_block_vals[i].setZero();
+    if (block_vals.rows() != channels)
+    {
+      block_vals.resize(channels, buffer_size);
+      block_vals.setZero();
+      continue;
+    }
+    // The input buffer grew (after rewinding), so keep what's there like it does
+    const long old_cols = block_vals.cols();
+    block_vals.conservativeResize(Eigen::NoChange, buffer_size);
+    block_vals.rightCols(buffer_size - old_cols).setZero();
   }
 }
 
@@ -181,3 +271,69 @@ void nam::convnet::ConvNet::_rewind_buffers_()
   // Now we can do the rest of the rewind
   this->Buffer::_rewind_buffers_();
 }
+
+void nam::convnet::ConvNet::_pack_weights_(WeightArena& arena)
+{
+  for (auto& block : this->_blocks)
+    block.pack_(arena);
+  this->_head.pack_(arena);
+}
+
+void nam::convnet::ConvNet::_quantize_int8_()
+{
+  for (auto& block : this->_blocks)
+    block.quantize_int8_();
+}
+
+int nam::convnet::ConvNet::_sparsify_(const float threshold)
+{
+  int num_sparse = 0;
+  for (auto& block : this->_blocks)
+    num_sparse += block.sparsify_(threshold);
+  return num_sparse;
+}
+
+void nam::convnet::ConvNet::_prune_channels_(const float tolerance, std::vector<PrunedChannels>& report)
+{
+  const size_t num_blocks = this->_blocks.size();
+  // The output channels of each block that are still alive
+  std::vector<prune::Channels> channels;
+  for (const auto& block : this->_blocks)
+    channels.push_back(prune::all(block.get_out_channels()));
+  const prune::Channels input = prune::all(1);
+  auto input_of = [&](const size_t i) -> const prune::Channels& { return i == 0 ? input : channels[i - 1]; };
+
+  // A channel is dead if nothing reads it, or if it's always zero. Each one dropped can kill others, so go until
+  // nothing changes.
+  bool changed = true;
+  while (changed)
+  {
+    changed = false;
+    for (size_t i = 0; i < num_blocks; i++)
+    {
+      prune::Channels alive;
+      for (const long c : channels[i])
+      {
+        const bool read = i + 1 < num_blocks ? !this->_blocks[i + 1].is_unread_input_(c, channels[i + 1], tolerance)
+                                             : !this->_head.is_unread_input_(c, tolerance);
+        if (read && !this->_blocks[i].is_dead_output_(c, input_of(i), tolerance))
+          alive.push_back(c);
+      }
+      changed = changed || alive.size() < channels[i].size();
+      channels[i] = alive;
+    }
+  }
+
+  for (size_t i = 0; i < num_blocks; i++)
+  {
+    const std::string name = "blocks[" + std::to_string(i) + "]";
+    report.push_back({name, this->_blocks[i].get_out_channels(), (long)channels[i].size()});
+    this->_blocks[i].select_channels_(channels[i], input_of(i));
+    // Keep the history the next block's dilated convolution reads (unless nothing's been processed yet)
+    Eigen::MatrixXf& block_vals = this->_block_vals[i + 1];
+    if (block_vals.size() > 0)
+      block_vals = prune::select(block_vals, channels[i], prune::all(block_vals.cols()));
+  }
+  if (num_blocks > 0)
+    this->_head.select_channels_(channels.back());
+}
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cmath>
 #include <filesystem>
 #include <iterator>
 #include <memory>
@@ -23,8 +24,12 @@ class BatchNorm
 {
 public:
   BatchNorm(){};
-  BatchNorm(const int dim, std::vector<float>::iterator& weights);
+  BatchNorm(const int dim, weights_it& weights);
   void process_(Eigen::MatrixXf& input, const long i_start, const long i_end) const;
+  void pack_(WeightArena& arena);
+  // What channel c comes out as when it goes in as zero
+  float get_loc(const long c) const { return this->loc.view()(c); };
+  void select_channels_(const prune::Channels& channels);
 
 private:
   // TODO simplify to just ax+b
@@ -32,8 +37,8 @@ private:
   // y = ax+b
   // a = w / sqrt(v+eps)
   // b = a * m + bias
-  Eigen::VectorXf scale;
-  Eigen::VectorXf loc;
+  PackedVector scale;
+  PackedVector loc;
 };
 
 class ConvNetBlock
@@ -41,9 +46,17 @@ class ConvNetBlock
 public:
   ConvNetBlock(){};
   void set_weights_(const int in_channels, const int out_channels, const int _dilation, const bool batchnorm,
-                    const std::string activation, std::vector<float>::iterator& weights);
+                    const std::string activation, weights_it& weights);
   void process_(const Eigen::MatrixXf& input, Eigen::MatrixXf& output, const long i_start, const long i_end) const;
   long get_out_channels() const;
+  void pack_(WeightArena& arena);
+  void quantize_int8_() { this->conv.quantize_int8_(); };
+  int sparsify_(const float threshold) { return this->conv.sparsify_(threshold); };
+  // Whether output channel c is always (close to) zero, given the input channels that are left
+  bool is_dead_output_(const long c, const prune::Channels& in_channels, const float tolerance) const;
+  // Whether no output channel that's left reads input channel c
+  bool is_unread_input_(const long c, const prune::Channels& out_channels, const float tolerance) const;
+  void select_channels_(const prune::Channels& out_channels, const prune::Channels& in_channels);
   Conv1D conv;
 
 private:
@@ -56,11 +69,19 @@ class _Head
 {
 public:
   _Head(){};
-  _Head(const int channels, std::vector<float>::iterator& weights);
-  void process_(const Eigen::MatrixXf& input, Eigen::VectorXf& output, const long i_start, const long i_end) const;
+  _Head(const int channels, weights_it& weights);
+  // Writes i_end - i_start frames to `output`
+  void process_(const Eigen::MatrixXf& input, Eigen::Ref<Eigen::VectorXf> output, const long i_start,
+                const long i_end) const;
+  void pack_(WeightArena& arena);
+  bool is_unread_input_(const long c, const float tolerance) const
+  {
+    return std::abs(this->_weight.view()(c)) <= tolerance;
+  };
+  void select_channels_(const prune::Channels& channels);
 
 private:
-  Eigen::VectorXf _weight;
+  PackedVector _weight;
   float _bias = 0.0f;
 };
 
@@ -68,20 +89,27 @@ class ConvNet : public Buffer
 {
 public:
   ConvNet(const int channels, const std::vector<int>& dilations, const bool batchnorm, const std::string activation,
-          std::vector<float>& weights, const double expected_sample_rate = -1.0);
+          std::span<const float> weights, const double expected_sample_rate = -1.0);
   ~ConvNet() = default;
 
 protected:
   std::vector<ConvNetBlock> _blocks;
   std::vector<Eigen::MatrixXf> _block_vals;
-  Eigen::VectorXf _head_output;
   _Head _head;
   void _verify_weights(const int channels, const std::vector<int>& dilations, const bool batchnorm,
                        const size_t actual_weights);
-  void _update_buffers_(NAM_SAMPLE* input, const int num_frames) override;
+  void _update_buffers_(const float* input, const int num_frames) override;
   void _rewind_buffers_() override;
-
-  void process(NAM_SAMPLE* input, NAM_SAMPLE* output, const int num_frames) override;
+  void _prepare_(const int max_num_frames) override;
+  int _get_render_block_size_() const override;
+  long _get_receptive_field_() const override;
+  // Size the block values like the input buffer
+  void _resize_block_vals_();
+  void _pack_weights_(WeightArena& arena) override;
+  void _quantize_int8_() override;
+  int _sparsify_(const float threshold) override;
+  void _prune_channels_(const float tolerance, std::vector<PrunedChannels>& report) override;
+  void _process_(const float* input, float* output, const int num_frames) override;
 };
 }; // namespace convnet
 }; // namespace nam
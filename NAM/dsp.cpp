@@ -24,8 +24,8 @@ void nam::DSP::prewarm()
   if (_prewarm_samples == 0)
     return;
 
-  NAM_SAMPLE sample = 0;
-  NAM_SAMPLE* sample_ptr = &sample;
+  float sample = 0;
+  float* sample_ptr = &sample;
 
   // pre-warm the model for a model-specific number of samples
   for (long i = 0; i < _prewarm_samples; i++)
@@ -36,11 +36,61 @@ void nam::DSP::prewarm()
   }
 }
 
-void nam::DSP::process(NAM_SAMPLE* input, NAM_SAMPLE* output, const int num_frames)
+void nam::DSP::prepare(const int max_block_size)
+{
+  if ((long)this->_float_input.size() < max_block_size)
+  {
+    this->_float_input.resize(max_block_size);
+    this->_float_output.resize(max_block_size);
+  }
+  this->_prepare_(max_block_size);
+  this->_max_block_size = std::max(this->_max_block_size, max_block_size);
+}
+
+void nam::DSP::render(const float* input, float* output, const size_t num_frames)
+{
+  const int block_size = this->get_render_block_size();
+  this->prepare(block_size);
+  for (size_t start = 0; start < num_frames; start += block_size)
+  {
+    const int n = (int)std::min((size_t)block_size, num_frames - start);
+    this->process(input + start, output + start, n);
+    this->finalize_(n);
+  }
+}
+
+int nam::DSP::_fit_render_block_size(const long floats_per_frame)
+{
+  int block_size = kMaxRenderBlockSize;
+  while (block_size > kMinRenderBlockSize && block_size * floats_per_frame * (long)sizeof(float) > kRenderCacheBytes)
+    block_size /= 2;
+  return block_size;
+}
+
+void nam::DSP::process(const float* input, float* output, const int num_frames)
+{
+  this->_process_(input, output, num_frames);
+}
+
+void nam::DSP::process(const double* input, double* output, const int num_frames)
+{
+  if ((long)this->_float_input.size() < num_frames)
+  {
+    this->_float_input.resize(num_frames);
+    this->_float_output.resize(num_frames);
+  }
+  Eigen::Map<Eigen::VectorXf>(this->_float_input.data(), num_frames) =
+    Eigen::Map<const Eigen::VectorXd>(input, num_frames).cast<float>();
+  this->_process_(this->_float_input.data(), this->_float_output.data(), num_frames);
+  Eigen::Map<Eigen::VectorXd>(output, num_frames) =
+    Eigen::Map<const Eigen::VectorXf>(this->_float_output.data(), num_frames).cast<double>();
+}
+
+void nam::DSP::_process_(const float* input, float* output, const int num_frames)
 {
   // Default implementation is the null operation
-  for (size_t i = 0; i < num_frames; i++)
-    output[i] = input[i];
+  if (output != input)
+    std::copy(input, input + num_frames, output);
 }
 
 double nam::DSP::GetLoudness() const
@@ -60,6 +110,94 @@ void nam::DSP::SetLoudness(const double loudness)
 
 void nam::DSP::finalize_(const int num_frames) {}
 
+void nam::DSP::pack_weights(const WeightFormat format)
+{
+  if (this->_weight_arena.is_allocated() && this->_weight_arena.get_format() == format)
+    return;
+  this->_repack_weights_(format);
+}
+
+void nam::DSP::_repack_weights_(const WeightFormat format)
+{
+  // Measure, then copy. Repacking reads from the old arena, so it has to outlive the copy.
+  WeightArena arena(format);
+  this->_pack_weights_(arena);
+  arena.allocate();
+  this->_pack_weights_(arena);
+  this->_weight_arena = std::move(arena);
+}
+
+bool nam::DSP::use_shared_weights(std::shared_ptr<const SharedWeights> weights)
+{
+  WeightArena arena(std::move(weights));
+  // Measure, check, and only then switch over so that a mismatch leaves us as we were.
+  this->_pack_weights_(arena);
+  arena.allocate();
+  if (!arena.matches())
+    return false;
+  this->_pack_weights_(arena);
+  if (!arena.matches())
+    return false;
+  arena.finish_verifying();
+  this->_pack_weights_(arena);
+  this->_weight_arena = std::move(arena);
+  return true;
+}
+
+std::span<const float> nam::DSP::get_packed_weights() const
+{
+  if (!this->_weight_arena.is_allocated())
+    return {};
+  return std::span<const float>(this->_weight_arena.data(), this->_weight_arena.get_size());
+}
+
+void nam::DSP::quantize_int8()
+{
+  if (this->_quantized_int8)
+    return;
+  this->_quantize_int8_();
+  this->_quantized_int8 = true;
+  // Stay prepared: int8 convolutions have scratch space of their own
+  if (this->_max_block_size > 0)
+    this->_prepare_(this->_max_block_size);
+}
+
+int nam::DSP::sparsify(const float threshold)
+{
+  this->_sparsity_threshold = threshold;
+  return this->_sparsify_(threshold);
+}
+
+std::vector<nam::LowRankReport> nam::DSP::factorize_low_rank(const float max_error)
+{
+  this->_low_rank_max_error = max_error;
+  std::vector<LowRankReport> report;
+  this->_factorize_low_rank_(max_error, report);
+  if (this->_max_block_size > 0)
+    this->_prepare_(this->_max_block_size);
+  return report;
+}
+
+std::vector<nam::PrunedChannels> nam::DSP::prune_channels(const float tolerance)
+{
+  std::vector<PrunedChannels> report;
+  this->_prune_channels_(tolerance, report);
+  // The pruned weights own their coefficients again, and the modules that were pruned dropped their other copies.
+  if (this->_weight_arena.is_allocated())
+    this->_repack_weights_(this->_weight_arena.get_format());
+  if (this->_quantized_int8)
+    this->_quantize_int8_();
+  if (this->_low_rank_max_error >= 0.0f)
+  {
+    std::vector<LowRankReport> low_rank_report;
+    this->_factorize_low_rank_(this->_low_rank_max_error, low_rank_report);
+  }
+  this->_sparsify_(this->_sparsity_threshold);
+  if (this->_max_block_size > 0)
+    this->_prepare_(this->_max_block_size);
+  return report;
+}
+
 // Buffer =====================================================================
 
 nam::Buffer::Buffer(const int receptive_field, const double expected_sample_rate)
@@ -81,34 +219,42 @@ void nam::Buffer::_set_receptive_field(const int new_receptive_field, const int
   this->_reset_input_buffer();
 }
 
-void nam::Buffer::_update_buffers_(NAM_SAMPLE* input, const int num_frames)
+void nam::Buffer::_update_buffers_(const float* input, const int num_frames)
 {
   // Make sure that the buffer is big enough for the receptive field and the
   // frames needed!
-  {
-    const long minimum_input_buffer_size = (long)this->_receptive_field + _INPUT_BUFFER_SAFETY_FACTOR * num_frames;
-    if ((long)this->_input_buffer.size() < minimum_input_buffer_size)
-    {
-      long new_buffer_size = 2;
-      while (new_buffer_size < minimum_input_buffer_size)
-        new_buffer_size *= 2;
-      this->_input_buffer.resize(new_buffer_size);
-      std::fill(this->_input_buffer.begin(), this->_input_buffer.end(), 0.0f);
-    }
-  }
+  this->_reserve_input_buffer_(num_frames);
 
   // If we'd run off the end of the input buffer, then we need to move the data
   // back to the start of the buffer and start again.
   if (this->_input_buffer_offset + num_frames > (long)this->_input_buffer.size())
     this->_rewind_buffers_();
   // Put the new samples into the input buffer
-  for (long i = this->_input_buffer_offset, j = 0; j < num_frames; i++, j++)
-    this->_input_buffer[i] = input[j];
+  std::copy(input, input + num_frames, this->_input_buffer.begin() + this->_input_buffer_offset);
   // And resize the output buffer:
   this->_output_buffer.resize(num_frames);
   std::fill(this->_output_buffer.begin(), this->_output_buffer.end(), 0.0f);
 }
 
+void nam::Buffer::_prepare_(const int max_num_frames)
+{
+  this->_reserve_input_buffer_(max_num_frames);
+  this->_output_buffer.reserve(max_num_frames);
+}
+
+void nam::Buffer::_reserve_input_buffer_(const int num_frames)
+{
+  const long minimum_input_buffer_size = (long)this->_receptive_field + _INPUT_BUFFER_SAFETY_FACTOR * num_frames;
+  if ((long)this->_input_buffer.size() >= minimum_input_buffer_size)
+    return;
+  long new_buffer_size = 2;
+  while (new_buffer_size < minimum_input_buffer_size)
+    new_buffer_size *= 2;
+  // Move the history to the front so that it survives; the new space is zeros.
+  this->_rewind_buffers_();
+  this->_input_buffer.resize(new_buffer_size, 0.0f);
+}
+
 void nam::Buffer::_rewind_buffers_()
 {
   // Copy the input buffer back
@@ -136,7 +282,7 @@ void nam::Buffer::finalize_(const int num_frames)
 
 // Linear =====================================================================
 
-nam::Linear::Linear(const int receptive_field, const bool _bias, const std::vector<float>& weights,
+nam::Linear::Linear(const int receptive_field, const bool _bias, std::span<const float> weights,
                     const double expected_sample_rate)
 : nam::Buffer(receptive_field, expected_sample_rate)
 {
@@ -148,26 +294,35 @@ nam::Linear::Linear(const int receptive_field, const bool _bias, const std::vect
   this->_weight.resize(this->_receptive_field);
   // Pass in in reverse order so that dot products work out of the box.
   for (int i = 0; i < this->_receptive_field; i++)
-    this->_weight(i) = weights[receptive_field - 1 - i];
+    this->_weight.get_()(i) = weights[receptive_field - 1 - i];
   this->_bias = _bias ? weights[receptive_field] : (float)0.0;
 }
 
-void nam::Linear::process(NAM_SAMPLE* input, NAM_SAMPLE* output, const int num_frames)
+void nam::Linear::_process_(const float* input, float* output, const int num_frames)
 {
   this->nam::Buffer::_update_buffers_(input, num_frames);
 
   // Main computation!
   for (size_t i = 0; i < num_frames; i++)
-  {
-    const size_t offset = this->_input_buffer_offset - this->_weight.size() + i + 1;
-    auto input = Eigen::Map<const Eigen::VectorXf>(&this->_input_buffer[offset], this->_receptive_field);
-    output[i] = this->_bias + this->_weight.dot(input);
-  }
+    output[i] = this->_bias;
+  this->_weight.for_each_panel_([&](const auto& weight, const long row, const long) {
+    for (size_t i = 0; i < num_frames; i++)
+    {
+      const size_t offset = this->_input_buffer_offset - this->_weight.size() + i + 1 + row;
+      auto input = Eigen::Map<const Eigen::VectorXf>(&this->_input_buffer[offset], weight.rows());
+      output[i] += weight.dot(input);
+    }
+  });
+}
+
+void nam::Linear::_pack_weights_(WeightArena& arena)
+{
+  this->_weight.pack_(arena, true);
 }
 
 // NN modules =================================================================
 
-void nam::Conv1D::set_weights_(std::vector<float>::iterator& weights)
+void nam::Conv1D::set_weights_(weights_it& weights)
 {
   if (this->_weight.size() > 0)
   {
@@ -177,10 +332,10 @@ void nam::Conv1D::set_weights_(std::vector<float>::iterator& weights)
     for (auto i = 0; i < out_channels; i++)
       for (auto j = 0; j < in_channels; j++)
         for (size_t k = 0; k < this->_weight.size(); k++)
-          this->_weight[k](i, j) = *(weights++);
+          this->_weight[k].get_()(i, j) = *(weights++);
   }
   for (long i = 0; i < this->_bias.size(); i++)
-    this->_bias(i) = *(weights++);
+    this->_bias.get_()(i) = *(weights++);
 }
 
 void nam::Conv1D::set_size_(const int in_channels, const int out_channels, const int kernel_size, const bool do_bias,
@@ -198,26 +353,50 @@ void nam::Conv1D::set_size_(const int in_channels, const int out_channels, const
 }
 
 void nam::Conv1D::set_size_and_weights_(const int in_channels, const int out_channels, const int kernel_size,
-                                        const int _dilation, const bool do_bias, std::vector<float>::iterator& weights)
+                                        const int _dilation, const bool do_bias, weights_it& weights)
 {
   this->set_size_(in_channels, out_channels, kernel_size, do_bias, _dilation);
   this->set_weights_(weights);
 }
 
-void nam::Conv1D::process_(const Eigen::MatrixXf& input, Eigen::MatrixXf& output, const long i_start, const long ncols,
-                           const long j_start) const
+void nam::Conv1D::process_(const Eigen::MatrixXf& input, Eigen::Ref<Eigen::MatrixXf> output, const long i_start,
+                           const long ncols, const long j_start) const
 {
+  if (!this->_weight_int8.empty())
+  {
+    // Quantize everything the taps read just once
+    const long first = i_start + this->_dilation * (1 - (long)this->_weight_int8.size());
+    const int32_t input_max = this->_weight_int8[0].get_input_max();
+    this->_input_int16.quantize_(input.middleCols(first, i_start + ncols - first), input_max);
+    for (size_t k = 0; k < this->_weight_int8.size(); k++)
+    {
+      const long offset = this->_dilation * (k + 1 - this->_weight_int8.size());
+      this->_weight_int8[k].multiply_(this->_input_int16, i_start + offset - first, output.middleCols(j_start, ncols),
+                                      k > 0);
+    }
+    if (this->_bias.size() > 0)
+      output.middleCols(j_start, ncols).colwise() += this->_bias.view();
+    return;
+  }
   // This is the clever part ;)
   for (size_t k = 0; k < this->_weight.size(); k++)
   {
     const long offset = this->_dilation * (k + 1 - this->_weight.size());
-    if (k == 0)
-      output.middleCols(j_start, ncols) = this->_weight[k] * input.middleCols(i_start + offset, ncols);
+    if (!this->_weight_sparse.empty() && !this->_weight_sparse[k].empty())
+      this->_weight_sparse[k].multiply_(input.middleCols(i_start + offset, ncols), output.middleCols(j_start, ncols),
+                                        k > 0);
     else
-      output.middleCols(j_start, ncols) += this->_weight[k] * input.middleCols(i_start + offset, ncols);
+      this->_weight[k].multiply_(input.middleCols(i_start + offset, ncols), output.middleCols(j_start, ncols), k > 0);
   }
   if (this->_bias.size() > 0)
-    output.middleCols(j_start, ncols).colwise() += this->_bias;
+    output.middleCols(j_start, ncols).colwise() += this->_bias.view();
+}
+
+void nam::Conv1D::reserve_(const long max_num_frames)
+{
+  if (!this->_weight_int8.empty())
+    this->_input_int16.reserve_(
+      this->get_in_channels(), max_num_frames + this->_dilation * (this->get_kernel_size() - 1));
 }
 
 long nam::Conv1D::get_num_weights() const
@@ -228,6 +407,59 @@ long nam::Conv1D::get_num_weights() const
   return num_weights;
 }
 
+void nam::Conv1D::pack_(WeightArena& arena)
+{
+  for (auto& weight : this->_weight)
+    weight.pack_(arena, true);
+  this->_bias.pack_(arena);
+}
+
+void nam::Conv1D::quantize_int8_()
+{
+  this->_weight_int8.clear();
+  for (const auto& weight : this->_weight)
+    this->_weight_int8.emplace_back(weight.to_float());
+}
+
+int nam::Conv1D::sparsify_(const float threshold)
+{
+  int num_sparse = 0;
+  this->_weight_sparse.clear();
+  if (!this->_weight_int8.empty())
+    return 0; // Int8 wins
+  this->_weight_sparse.resize(this->_weight.size());
+  for (size_t k = 0; k < this->_weight.size(); k++)
+  {
+    const auto weight = this->_weight[k].to_float();
+    if (SparseMatrix::get_sparsity(weight) >= threshold)
+    {
+      this->_weight_sparse[k] = SparseMatrix(weight);
+      num_sparse++;
+    }
+  }
+  if (num_sparse == 0)
+    this->_weight_sparse.clear();
+  return num_sparse;
+}
+
+void nam::Conv1D::select_channels_(const prune::Channels& out_channels, const prune::Channels& in_channels)
+{
+  for (auto& weight : this->_weight)
+  {
+    const Eigen::MatrixXf selected = prune::select(weight.to_float(), out_channels, in_channels);
+    weight.resize(selected.rows(), selected.cols());
+    weight.get_() = selected;
+  }
+  if (this->_bias.size() > 0)
+  {
+    const Eigen::MatrixXf selected = prune::select(this->_bias.view(), out_channels, prune::all(1));
+    this->_bias.resize(selected.rows());
+    this->_bias.get_() = selected;
+  }
+  this->_weight_int8.clear();
+  this->_weight_sparse.clear();
+}
+
 nam::Conv1x1::Conv1x1(const int in_channels, const int out_channels, const bool _bias)
 {
   this->_weight.resize(out_channels, in_channels);
@@ -236,20 +468,95 @@ nam::Conv1x1::Conv1x1(const int in_channels, const int out_channels, const bool
     this->_bias.resize(out_channels);
 }
 
-void nam::Conv1x1::set_weights_(std::vector<float>::iterator& weights)
+void nam::Conv1x1::set_weights_(weights_it& weights)
 {
   for (int i = 0; i < this->_weight.rows(); i++)
     for (int j = 0; j < this->_weight.cols(); j++)
-      this->_weight(i, j) = *(weights++);
+      this->_weight.get_()(i, j) = *(weights++);
   if (this->_do_bias)
     for (int i = 0; i < this->_bias.size(); i++)
-      this->_bias(i) = *(weights++);
+      this->_bias.get_()(i) = *(weights++);
 }
 
-Eigen::MatrixXf nam::Conv1x1::process(const Eigen::MatrixXf& input) const
+Eigen::MatrixXf nam::Conv1x1::process(const Eigen::Ref<const Eigen::MatrixXf>& input) const
 {
-  if (this->_do_bias)
-    return (this->_weight * input).colwise() + this->_bias;
+  Eigen::MatrixXf output(this->get_out_channels(), input.cols());
+  this->process_(input, output);
+  return output;
+}
+
+void nam::Conv1x1::process_(const Eigen::Ref<const Eigen::MatrixXf>& input, Eigen::Ref<Eigen::MatrixXf> output) const
+{
+  if (!this->_weight_int8.empty())
+  {
+    this->_input_int16.quantize_(input, this->_weight_int8.get_input_max());
+    this->_weight_int8.multiply_(this->_input_int16, 0, output, false);
+  }
+  else if (!this->_weight_low_rank.empty())
+    this->_weight_low_rank.multiply_(input, output);
+  else if (!this->_weight_sparse.empty())
+    this->_weight_sparse.multiply_(input, output, false);
   else
-    return this->_weight * input;
+    this->_weight.multiply_(input, output, false);
+  if (this->_do_bias)
+    output.colwise() += this->_bias.view();
+}
+
+void nam::Conv1x1::reserve_(const long max_num_frames)
+{
+  if (!this->_weight_int8.empty())
+    this->_input_int16.reserve_(this->get_in_channels(), max_num_frames);
+  if (!this->_weight_low_rank.empty())
+    this->_weight_low_rank.reserve_(max_num_frames);
+}
+
+void nam::Conv1x1::pack_(WeightArena& arena)
+{
+  this->_weight.pack_(arena, true);
+  this->_bias.pack_(arena);
+}
+
+void nam::Conv1x1::quantize_int8_()
+{
+  this->_weight_int8 = Int8Matrix(this->_weight.to_float());
+}
+
+int nam::Conv1x1::sparsify_(const float threshold)
+{
+  const auto weight = this->_weight.to_float();
+  if (!this->_weight_int8.empty() || !this->_weight_low_rank.empty() || SparseMatrix::get_sparsity(weight) < threshold)
+  {
+    this->_weight_sparse = SparseMatrix();
+    return 0;
+  }
+  this->_weight_sparse = SparseMatrix(weight);
+  return 1;
+}
+
+nam::LowRankReport nam::Conv1x1::factorize_low_rank_(const float max_error, const std::string& name)
+{
+  const auto weight = this->_weight.to_float();
+  LowRankMatrix low_rank(weight, max_error);
+  const LowRankReport report{name, weight.rows(), weight.cols(), low_rank.rank(), low_rank.get_error(),
+                             this->_weight_int8.empty() && !low_rank.empty()};
+  this->_weight_low_rank = report.factored ? std::move(low_rank) : LowRankMatrix();
+  if (report.factored)
+    this->_weight_sparse = SparseMatrix();
+  return report;
+}
+
+void nam::Conv1x1::select_channels_(const prune::Channels& out_channels, const prune::Channels& in_channels)
+{
+  const Eigen::MatrixXf selected = prune::select(this->_weight.to_float(), out_channels, in_channels);
+  this->_weight.resize(selected.rows(), selected.cols());
+  this->_weight.get_() = selected;
+  if (this->_do_bias)
+  {
+    const Eigen::MatrixXf selected_bias = prune::select(this->_bias.view(), out_channels, prune::all(1));
+    this->_bias.resize(selected_bias.rows());
+    this->_bias.get_() = selected_bias;
+  }
+  this->_weight_int8 = Int8Matrix();
+  this->_weight_sparse = SparseMatrix();
+  this->_weight_low_rank = LowRankMatrix();
 }
@@ -1,8 +1,11 @@
 #pragma once
 
+#include <cstddef>
 #include <filesystem>
+#include <istream>
 #include <iterator>
 #include <memory>
+#include <span>
 #include <string>
 #include <unordered_map>
 #include <vector>
@@ -11,7 +14,13 @@
 
 #include "activations.h"
 #include "json.hpp"
+#include "low_rank.h"
+#include "prune.h"
+#include "quantize.h"
+#include "sparse.h"
+#include "weight_arena.h"
 
+// The sample type hosts work in. DSP::process() takes either; this only picks the default for code that uses it.
 #ifdef NAM_SAMPLE_FLOAT
   #define NAM_SAMPLE float
 #else
@@ -45,13 +54,29 @@ public:
   // prewarm() does any required intial work required to "settle" model initial conditions
   // it can be somewhat expensive, so should not be called during realtime audio processing
   virtual void prewarm();
+  // Allocate everything needed to process buffers of up to `max_block_size` frames, so that process() never has to
+  // (call it from your host's equivalent of prepareToPlay). Without it, the first buffer of each new largest size
+  // allocates. Smaller buffers never do, and the model keeps its state. Not realtime-safe.
+  void prepare(const int max_block_size);
+  // The largest buffer prepare() was called for (0 if never)
+  int get_max_block_size() const { return this->_max_block_size; };
+  // Offline rendering: process all `num_frames` frames of `input` into `output` (which may be the same buffer), however
+  // many that is, carrying on from the model's current state. They're processed (and finalized) in blocks of
+  // get_render_block_size() frames, which the model is prepared for. Not for the audio thread.
+  void render(const float* input, float* output, const size_t num_frames);
+  // How many frames at a time render() processes: as many as keep one layer's activations in cache
+  int get_render_block_size() const { return this->_get_render_block_size_(); };
+  // How many frames of input each frame of output depends on, its own included, or 0 if there's no limit (e.g. an
+  // LSTM, whose state carries on forever). Models with a limit can be rendered in parallel (see parallel_render.h).
+  long get_receptive_field() const { return this->_get_receptive_field_(); };
   // process() does all of the processing requried to take `input` array and
   // fill in the required values on `output`.
-  // To do this:
-  // 1. The core DSP algorithm is run (This is what should probably be
-  //    overridden in subclasses).
-  // 2. The output level is applied and the result stored to `output`.
-  virtual void process(NAM_SAMPLE* input, NAM_SAMPLE* output, const int num_frames);
+  // Models compute in float, so float buffers are used as they are, while double buffers are converted on the way in
+  // and out (the first double buffer of a given size allocates space for that). `input` and `output` may be the same
+  // buffer. The core DSP algorithm is _process_(); this is what should be overridden in subclasses. Wrappers that
+  // want to see the host's samples themselves can override these instead (both of them, or one hides the other).
+  virtual void process(const float* input, float* output, const int num_frames);
+  virtual void process(const double* input, double* output, const int num_frames);
   // Anything to take care of before next buffer comes in.
   // For example:
   // * Move the buffer index forward
@@ -68,6 +93,39 @@ public:
   // This is usually defined to be the loudness to a standardized input. The trainer has its own, but you can always
   // use this to define it a different way if you like yours better.
   void SetLoudness(const double loudness);
+  // Move all of the weights into one aligned arena (see weight_arena.h). get_dsp() does this for you (as float32); call
+  // it yourself if you construct models directly, or to store the big matrices in half precision instead (see
+  // half_precision.h). Not realtime-safe. Does nothing if the weights are already packed in `format`. Going back to
+  // float32 doesn't undo the rounding.
+  void pack_weights(const WeightFormat format = WeightFormat::kFloat32);
+  WeightFormat get_weight_format() const { return this->_weight_arena.get_format(); };
+  // Compute with the read-only weights in `weights` (see shared_weights.h) instead of a copy of our own. They must have
+  // been saved from an identical model: they're checked against the model's weights (which works whether or not
+  // those are packed yet), and if they don't match, this returns false and leaves the model as it was. If they're in
+  // half precision, the model's weights must round to them. Not realtime-safe.
+  bool use_shared_weights(std::shared_ptr<const SharedWeights> weights);
+  // The packed weights (empty until packed)
+  std::span<const float> get_packed_weights() const;
+  // Run the convolutions with int8 weights from now on (see quantize.h). Faster, a little less accurate. The float
+  // weights are kept. Architectures without convolutions ignore this. Not realtime-safe.
+  void quantize_int8();
+  bool is_quantized_int8() const { return this->_quantized_int8; };
+  // Multiply with block-sparse copies (see sparse.h) of the convolution and LSTM matrices that have at least
+  // `threshold` of their blocks all zero, and with the dense weights otherwise. get_dsp() does this with
+  // get_sparsity_threshold(); call it again to change your mind (a threshold above 1 goes back to dense everywhere).
+  // Returns how many matrices are sparse now. Int8 convolutions stay int8. Not realtime-safe.
+  int sparsify(const float threshold);
+  // Multiply with low-rank factorizations (see low_rank.h) of the WaveNet 1x1 convolutions (_1x1, _input_mixin and
+  // _head_rechannel) that are within `max_error` at a rank that saves multiply-adds, and with the dense weights
+  // otherwise. Call it again to change the bound. Returns what happened to each matrix; the result is only as close to
+  // the original as the error in each matrix lets it be, so check the model's output (e.g. `benchmodel --low-rank`).
+  // Int8 convolutions stay int8. Not realtime-safe.
+  std::vector<LowRankReport> factorize_low_rank(const float max_error);
+  // Drop the WaveNet or ConvNet channels that contribute nothing, treating weights and activations within `tolerance`
+  // of zero as zero (see prune.h), and shrink the convolutions and buffers to match. Returns how many channels of each
+  // set are left. Repacks the weights, and redoes int8, sparse and low-rank copies as they were. Check the result's
+  // output if `tolerance` isn't 0 (e.g. `benchmodel --prune`). Not realtime-safe.
+  std::vector<PrunedChannels> prune_channels(const float tolerance);
 
 protected:
   bool mHasLoudness = false;
@@ -77,6 +135,47 @@ protected:
   double mExpectedSampleRate;
   // How many samples should be processed during "pre-warming"
   int _prewarm_samples = 0;
+  // Where the weights live once packed
+  WeightArena _weight_arena;
+  bool _quantized_int8 = false;
+  // What sparsify() and factorize_low_rank() were last called with (above 1 and below 0 mean never)
+  float _sparsity_threshold = 2.0f;
+  float _low_rank_max_error = -1.0f;
+
+  // The core DSP algorithm: fill in `output` from `input`, which may be the same buffer. Passes the input through by
+  // default.
+  virtual void _process_(const float* input, float* output, const int num_frames);
+  // Call pack_() on every module's weights. Must visit them in the same order every time it's called.
+  virtual void _pack_weights_(WeightArena& arena) {};
+  // Call quantize_int8_() on every convolution
+  virtual void _quantize_int8_() {};
+  // Call sparsify_() on every module that can use sparse weights, and add up what they return
+  virtual int _sparsify_(const float threshold) { return 0; };
+  // Call factorize_low_rank_() on every 1x1 convolution that may be factored
+  virtual void _factorize_low_rank_(const float max_error, std::vector<LowRankReport>& report) {};
+  // Find the dead channels and call select_channels_() on everything that has them, reporting on each set
+  virtual void _prune_channels_(const float tolerance, std::vector<PrunedChannels>& report) {};
+  // Make room for buffers of up to `max_num_frames` frames, keeping the model's state
+  virtual void _prepare_(const int max_num_frames) {};
+  // See get_render_block_size(). Models that work a frame at a time just want to keep calls few.
+  virtual int _get_render_block_size_() const { return kMaxRenderBlockSize; };
+  // See get_receptive_field()
+  virtual long _get_receptive_field_() const { return 0; };
+  // The render block size for a model whose biggest layer reads and writes `floats_per_frame` floats per frame: the
+  // largest power of two that keeps that within kRenderCacheBytes (a typical L2 cache), between kMinRenderBlockSize
+  // and kMaxRenderBlockSize
+  static int _fit_render_block_size(const long floats_per_frame);
+  static constexpr long kRenderCacheBytes = 256 * 1024;
+  static constexpr int kMinRenderBlockSize = 64;
+  static constexpr int kMaxRenderBlockSize = 8192;
+
+private:
+  int _max_block_size = 0;
+  // Pack the weights into a new arena in `format`, whether or not they're already packed
+  void _repack_weights_(const WeightFormat format);
+  // Where double buffers are converted to and from
+  std::vector<float> _float_input;
+  std::vector<float> _float_output;
 };
 
 // Class where an input buffer is kept so that long-time effects can be
@@ -101,51 +200,79 @@ protected:
   void _set_receptive_field(const int new_receptive_field);
   void _reset_input_buffer();
   // Use this->_input_post_gain
-  virtual void _update_buffers_(NAM_SAMPLE* input, int num_frames);
+  virtual void _update_buffers_(const float* input, int num_frames);
   virtual void _rewind_buffers_();
+  void _prepare_(const int max_num_frames) override;
+  // Grow the input buffer if it's too short to take `num_frames` frames at a time, keeping the receptive field's worth
+  // of history
+  void _reserve_input_buffer_(const int num_frames);
 };
 
 // Basic linear model (an IR!)
 class Linear : public Buffer
 {
 public:
-  Linear(const int receptive_field, const bool _bias, const std::vector<float>& weights,
+  Linear(const int receptive_field, const bool _bias, std::span<const float> weights,
          const double expected_sample_rate = -1.0);
-  void process(NAM_SAMPLE* input, NAM_SAMPLE* output, const int num_frames) override;
 
 protected:
-  Eigen::VectorXf _weight;
+  PackedVector _weight;
   float _bias;
+
+  void _process_(const float* input, float* output, const int num_frames) override;
+  void _pack_weights_(WeightArena& arena) override;
+  long _get_receptive_field_() const override { return this->_receptive_field; };
 };
 
 // NN modules =================================================================
 
+// Modules read their parameters off of a flat array, in the order that the trainer exports them. The array might be
+// owned by a std::vector or be a view into a memory-mapped model file.
+typedef std::span<const float>::iterator weights_it;
+
 class Conv1D
 {
 public:
   Conv1D() { this->_dilation = 1; };
-  void set_weights_(std::vector<float>::iterator& weights);
+  void set_weights_(weights_it& weights);
   void set_size_(const int in_channels, const int out_channels, const int kernel_size, const bool do_bias,
                  const int _dilation);
   void set_size_and_weights_(const int in_channels, const int out_channels, const int kernel_size, const int _dilation,
-                             const bool do_bias, std::vector<float>::iterator& weights);
+                             const bool do_bias, weights_it& weights);
   // Process from input to output
   //  Rightmost indices of input go from i_start to i_end,
   //  Indices on output for from j_start (to j_start + i_end - i_start)
-  void process_(const Eigen::MatrixXf& input, Eigen::MatrixXf& output, const long i_start, const long i_end,
+  void process_(const Eigen::MatrixXf& input, Eigen::Ref<Eigen::MatrixXf> output, const long i_start, const long i_end,
                 const long j_start) const;
+  // Make room to process up to `max_num_frames` frames at a time without allocating
+  void reserve_(const long max_num_frames);
   long get_in_channels() const { return this->_weight.size() > 0 ? this->_weight[0].cols() : 0; };
   long get_kernel_size() const { return this->_weight.size(); };
   long get_num_weights() const;
   long get_out_channels() const { return this->_weight.size() > 0 ? this->_weight[0].rows() : 0; };
   int get_dilation() const { return this->_dilation; };
+  // Copies of the weights of tap k and of the bias (empty if there's none)
+  Eigen::MatrixXf get_weight(const long k) const { return this->_weight[k].to_float(); };
+  Eigen::VectorXf get_bias() const { return this->_bias.view(); };
+  // Keep only the given output and input channels. Drops the int8 and sparse copies.
+  void select_channels_(const prune::Channels& out_channels, const prune::Channels& in_channels);
+  void pack_(WeightArena& arena);
+  // Compute with int8 copies of the weights from now on
+  void quantize_int8_();
+  // Use sparse copies of the taps that are sparse enough, and the dense ones otherwise. Returns how many are sparse.
+  int sparsify_(const float threshold);
 
 private:
   // Gonna wing this...
   // conv[kernel](cout, cin)
-  std::vector<Eigen::MatrixXf> _weight;
-  Eigen::VectorXf _bias;
+  std::vector<PackedMatrix> _weight;
+  PackedVector _bias;
   int _dilation;
+  // Same shape as _weight, or empty if not quantized
+  std::vector<Int8Matrix> _weight_int8;
+  mutable Int16Activations _input_int16;
+  // One per tap, or empty if none are sparse. Taps kept dense have an empty SparseMatrix.
+  std::vector<SparseMatrix> _weight_sparse;
 };
 
 // Really just a linear layer
@@ -153,17 +280,42 @@ class Conv1x1
 {
 public:
   Conv1x1(const int in_channels, const int out_channels, const bool _bias);
-  void set_weights_(std::vector<float>::iterator& weights);
+  void set_weights_(weights_it& weights);
   // :param input: (N,Cin) or (Cin,)
   // :return: (N,Cout) or (Cout,), respectively
-  Eigen::MatrixXf process(const Eigen::MatrixXf& input) const;
+  Eigen::MatrixXf process(const Eigen::Ref<const Eigen::MatrixXf>& input) const;
+  // Same, into `output`, which must already be the right size.
+  void process_(const Eigen::Ref<const Eigen::MatrixXf>& input, Eigen::Ref<Eigen::MatrixXf> output) const;
+  // Make room for process_() to take up to `max_num_frames` frames at a time without allocating
+  void reserve_(const long max_num_frames);
 
+  long get_in_channels() const { return this->_weight.cols(); };
   long get_out_channels() const { return this->_weight.rows(); };
+  // Copies of the weights and of the bias (empty if there's none)
+  Eigen::MatrixXf get_weight() const { return this->_weight.to_float(); };
+  Eigen::VectorXf get_bias() const { return this->_bias.view(); };
+  // Keep only the given output and input channels. Drops the int8, sparse and low-rank copies.
+  void select_channels_(const prune::Channels& out_channels, const prune::Channels& in_channels);
+  void pack_(WeightArena& arena);
+  // Compute with an int8 copy of the weights from now on
+  void quantize_int8_();
+  // Use a sparse copy of the weights if they're sparse enough, and the dense ones otherwise. Returns 1 if sparse.
+  int sparsify_(const float threshold);
+  // Use a low-rank factorization of the weights if it's within `max_error` and saves multiply-adds. Reports on it as
+  // `name`.
+  LowRankReport factorize_low_rank_(const float max_error, const std::string& name);
 
 private:
-  Eigen::MatrixXf _weight;
-  Eigen::VectorXf _bias;
+  PackedMatrix _weight;
+  PackedVector _bias;
   bool _do_bias;
+  // Empty unless quantized
+  Int8Matrix _weight_int8;
+  mutable Int16Activations _input_int16;
+  // Empty unless sparse
+  SparseMatrix _weight_sparse;
+  // Empty unless factored. Takes precedence over _weight_sparse.
+  LowRankMatrix _weight_low_rank;
 };
 
 // Utilities ==================================================================
@@ -199,11 +351,26 @@ struct dspData
 void verify_config_version(const std::string version);
 
 // Takes the model file and uses it to instantiate an instance of DSP.
+// Both .nam (JSON) files and binary models (see binary_model.h) are accepted.
 std::unique_ptr<DSP> get_dsp(const std::filesystem::path model_file);
 // Creates an instance of DSP. Also returns a dspData struct that holds the data of the model.
 std::unique_ptr<DSP> get_dsp(const std::filesystem::path model_file, dspData& returnedConfig);
-// Instantiates a DSP object from dsp_config struct.
-std::unique_ptr<DSP> get_dsp(dspData& conf);
+// Instantiates a DSP object from the contents of a model file that's already in memory (e.g. received over IPC or
+// fetched in a browser). Either format is accepted. `model_data` only needs to stay alive until this returns.
+std::unique_ptr<DSP> get_dsp(std::span<const std::byte> model_data);
+// Same, reading the model from a stream. Open file streams in binary mode.
+std::unique_ptr<DSP> get_dsp(std::istream& model_stream);
+// Instantiates the model called `model_name` in a model pack (see model_pack.h).
+// To load several models from one pack, open it once with model_pack::ModelPack instead.
+std::unique_ptr<DSP> get_dsp(const std::filesystem::path pack_file, const std::string& model_name);
+// Instantiates a DSP object from dsp_config struct. `conf` is only read.
+std::unique_ptr<DSP> get_dsp(const dspData& conf);
+// Same, but the weights are taken from `weights` (e.g. a memory-mapped binary model) instead of `conf.weights`.
+std::unique_ptr<DSP> get_dsp(const dspData& conf, std::span<const float> weights);
+// Same, but the model computes with `packed` (see DSP::use_shared_weights()) if they're its weights, and packs a copy
+// of its own if they aren't or `packed` is null. Check get_packed_weights() to see which it did.
+std::unique_ptr<DSP> get_dsp(const dspData& conf, std::span<const float> weights,
+                             std::shared_ptr<const SharedWeights> packed);
 // Legacy loader for directory-type DSPs
 std::unique_ptr<DSP> get_dsp_legacy(const std::filesystem::path dirname);
 }; // namespace nam
@@ -1,12 +1,18 @@
 #include <fstream>
+#include <iterator>
 #include <sstream>
 #include <stdexcept>
 #include <unordered_set>
 
+#include "binary_model.h"
 #include "dsp.h"
 #include "json.hpp"
+#include "json_loader.h"
 #include "lstm.h"
+#include "model_pack.h"
 #include "convnet.h"
+#include "shared_weights.h"
+#include "util.h"
 #include "wavenet.h"
 
 namespace nam
@@ -66,69 +72,99 @@ void verify_config_version(const std::string versionStr)
   }
 }
 
-std::vector<float> GetWeights(nlohmann::json const& j, const std::filesystem::path config_path)
+namespace
 {
-  if (j.find("weights") != j.end())
-  {
-    auto weight_list = j["weights"];
-    std::vector<float> weights;
-    for (auto it = weight_list.begin(); it != weight_list.end(); ++it)
-      weights.push_back(*it);
-    return weights;
-  }
-  else
-    throw std::runtime_error("Corrupted model file is missing weights.");
+// The packed weights of the binary model mapped in `file`, for the model to compute with in place, or null if it
+// has none
+std::shared_ptr<const SharedWeights> mapped_packed_weights(std::shared_ptr<const util::MappedFile> file)
+{
+  WeightFormat format;
+  const std::span<const float> packed = binary_model::get_packed_weights(file->data(), file->size(), format);
+  if (packed.empty())
+    return nullptr;
+  return std::make_shared<const SharedWeights>(std::move(file), packed.data(), packed.size(), format);
 }
+}; // namespace
 
 std::unique_ptr<DSP> get_dsp(const std::filesystem::path config_filename)
 {
-  dspData temp;
-  return get_dsp(config_filename, temp);
+  if (!std::filesystem::exists(config_filename))
+    throw std::runtime_error("Config JSON doesn't exist!\n");
+  auto file = std::make_shared<const util::MappedFile>(config_filename);
+  if (binary_model::is_binary_model(file->data(), file->size()))
+  {
+    dspData conf;
+    const std::span<const float> weights = binary_model::parse(file->data(), file->size(), conf);
+    return get_dsp(conf, weights, mapped_packed_weights(std::move(file)));
+  }
+  return get_dsp(std::as_bytes(std::span<const char>(file->data(), file->size())));
 }
 
 std::unique_ptr<DSP> get_dsp(const std::filesystem::path config_filename, dspData& returnedConfig)
 {
   if (!std::filesystem::exists(config_filename))
     throw std::runtime_error("Config JSON doesn't exist!\n");
-  std::ifstream i(config_filename);
-  nlohmann::json j;
-  i >> j;
-  verify_config_version(j["version"]);
-
-  auto architecture = j["architecture"];
-  nlohmann::json config = j["config"];
-  std::vector<float> weights = GetWeights(j, config_filename);
-
-  // Assign values to returnedConfig
-  returnedConfig.version = j["version"];
-  returnedConfig.architecture = j["architecture"];
-  returnedConfig.config = j["config"];
-  returnedConfig.metadata = j["metadata"];
-  returnedConfig.weights = weights;
-  if (j.find("sample_rate") != j.end())
-    returnedConfig.expected_sample_rate = j["sample_rate"];
-  else
+  auto file = std::make_shared<const util::MappedFile>(config_filename);
+  // get_dsp(conf) only reads conf, so the model can be built straight from what we give back to the caller.
+  if (binary_model::is_binary_model(file->data(), file->size()))
   {
-    returnedConfig.expected_sample_rate = -1.0;
+    std::span<const float> weights = binary_model::parse(file->data(), file->size(), returnedConfig);
+    returnedConfig.weights.assign(weights.begin(), weights.end());
+    return get_dsp(returnedConfig, returnedConfig.weights, mapped_packed_weights(std::move(file)));
   }
+  json_loader::parse(file->data(), file->size(), returnedConfig);
+  return get_dsp(returnedConfig);
+}
 
+std::unique_ptr<DSP> get_dsp(std::span<const std::byte> model_data)
+{
+  const char* data = reinterpret_cast<const char*>(model_data.data());
+  if (model_pack::is_model_pack(data, model_data.size()))
+    throw std::runtime_error("This is a model pack; say which model in it to load");
+  dspData conf;
+  if (binary_model::is_binary_model(data, model_data.size()))
+  {
+    // Build straight from the weights in the buffer; nobody asked for a copy of them.
+    std::span<const float> weights = binary_model::parse(data, model_data.size(), conf);
+    return get_dsp(conf, weights);
+  }
+  json_loader::parse(data, model_data.size(), conf);
+  return get_dsp(conf);
+}
 
-  /*Copy to a new dsp_config object for get_dsp below,
-   since not sure if weights actually get modified as being non-const references on some
-   model constructors inside get_dsp(dsp_config& conf).
-   We need to return unmodified version of dsp_config via returnedConfig.*/
-  dspData conf = returnedConfig;
+std::unique_ptr<DSP> get_dsp(std::istream& model_stream)
+{
+  const std::string contents((std::istreambuf_iterator<char>(model_stream)), std::istreambuf_iterator<char>());
+  if (model_stream.bad())
+    throw std::runtime_error("Failed to read model from stream");
+  return get_dsp(std::as_bytes(std::span<const char>(contents)));
+}
 
-  return get_dsp(conf);
+std::unique_ptr<DSP> get_dsp(const std::filesystem::path pack_file, const std::string& model_name)
+{
+  if (!std::filesystem::exists(pack_file))
+    throw std::runtime_error("Model pack doesn't exist!\n");
+  return model_pack::ModelPack(pack_file).get_dsp(model_name);
+}
+
+std::unique_ptr<DSP> get_dsp(const dspData& conf)
+{
+  return get_dsp(conf, conf.weights);
+}
+
+std::unique_ptr<DSP> get_dsp(const dspData& conf, std::span<const float> weights)
+{
+  return get_dsp(conf, weights, nullptr);
 }
 
-std::unique_ptr<DSP> get_dsp(dspData& conf)
+std::unique_ptr<DSP> get_dsp(const dspData& conf, std::span<const float> weights,
+                             std::shared_ptr<const SharedWeights> packed)
 {
   verify_config_version(conf.version);
 
-  auto& architecture = conf.architecture;
-  nlohmann::json& config = conf.config;
-  std::vector<float>& weights = conf.weights;
+  // Only read from here on: conf may be what get_dsp(path, returnedConfig) gives back, or shared with other threads.
+  const std::string& architecture = conf.architecture;
+  const nlohmann::json& config = conf.config;
   bool haveLoudness = false;
   double loudness = 0.0;
 
@@ -136,7 +172,7 @@ std::unique_ptr<DSP> get_dsp(dspData& conf)
   {
     if (conf.metadata.find("loudness") != conf.metadata.end())
     {
-      loudness = conf.metadata["loudness"];
+      loudness = conf.metadata.at("loudness");
       haveLoudness = true;
     }
   }
@@ -145,43 +181,43 @@ std::unique_ptr<DSP> get_dsp(dspData& conf)
   std::unique_ptr<DSP> out = nullptr;
   if (architecture == "Linear")
   {
-    const int receptive_field = config["receptive_field"];
-    const bool _bias = config["bias"];
+    const int receptive_field = config.at("receptive_field");
+    const bool _bias = config.at("bias");
     out = std::make_unique<Linear>(receptive_field, _bias, weights, expectedSampleRate);
   }
   else if (architecture == "ConvNet")
   {
-    const int channels = config["channels"];
-    const bool batchnorm = config["batchnorm"];
+    const int channels = config.at("channels");
+    const bool batchnorm = config.at("batchnorm");
     std::vector<int> dilations;
-    for (size_t i = 0; i < config["dilations"].size(); i++)
-      dilations.push_back(config["dilations"][i]);
-    const std::string activation = config["activation"];
+    for (size_t i = 0; i < config.at("dilations").size(); i++)
+      dilations.push_back(config.at("dilations")[i]);
+    const std::string activation = config.at("activation");
     out = std::make_unique<convnet::ConvNet>(channels, dilations, batchnorm, activation, weights, expectedSampleRate);
   }
   else if (architecture == "LSTM")
   {
-    const int num_layers = config["num_layers"];
-    const int input_size = config["input_size"];
-    const int hidden_size = config["hidden_size"];
+    const int num_layers = config.at("num_layers");
+    const int input_size = config.at("input_size");
+    const int hidden_size = config.at("hidden_size");
     out = std::make_unique<lstm::LSTM>(num_layers, input_size, hidden_size, weights, expectedSampleRate);
   }
   else if (architecture == "WaveNet")
   {
     std::vector<wavenet::LayerArrayParams> layer_array_params;
-    for (size_t i = 0; i < config["layers"].size(); i++)
+    for (size_t i = 0; i < config.at("layers").size(); i++)
     {
-      nlohmann::json layer_config = config["layers"][i];
+      const nlohmann::json& layer_config = config.at("layers")[i];
       std::vector<int> dilations;
-      for (size_t j = 0; j < layer_config["dilations"].size(); j++)
-        dilations.push_back(layer_config["dilations"][j]);
-      layer_array_params.push_back(
-        wavenet::LayerArrayParams(layer_config["input_size"], layer_config["condition_size"], layer_config["head_size"],
-                                  layer_config["channels"], layer_config["kernel_size"], dilations,
-                                  layer_config["activation"], layer_config["gated"], layer_config["head_bias"]));
+      for (size_t j = 0; j < layer_config.at("dilations").size(); j++)
+        dilations.push_back(layer_config.at("dilations")[j]);
+      layer_array_params.emplace_back(layer_config.at("input_size"), layer_config.at("condition_size"),
+                                      layer_config.at("head_size"), layer_config.at("channels"),
+                                      layer_config.at("kernel_size"), dilations, layer_config.at("activation"),
+                                      layer_config.at("gated"), layer_config.at("head_bias"));
     }
-    const bool with_head = config["head"] == NULL;
-    const float head_scale = config["head_scale"];
+    const bool with_head = config.contains("head") && config.at("head") == NULL;
+    const float head_scale = config.at("head_scale");
     out = std::make_unique<wavenet::WaveNet>(layer_array_params, head_scale, with_head, weights, expectedSampleRate);
   }
   else
@@ -193,6 +229,10 @@ std::unique_ptr<DSP> get_dsp(dspData& conf)
     out->SetLoudness(loudness);
   }
 
+  // Straight from the modules to the shared weights, if we can: no need for a copy of our own in between.
+  if (packed == nullptr || !out->use_shared_weights(std::move(packed)))
+    out->pack_weights();
+  out->sparsify(get_sparsity_threshold());
   // "pre-warm" the model to settle initial conditions
   out->prewarm();
 
@@ -0,0 +1,282 @@
+#include <cstring>
+#include <stdexcept>
+
+#if defined(__x86_64__) || defined(_M_X64)
+  #define NAM_HALF_PRECISION_X86
+  #include <immintrin.h>
+  #if defined(_MSC_VER) && !defined(__clang__)
+    #include <intrin.h>
+  #endif
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+  #include <arm_neon.h>
+#endif
+
+#include "half_precision.h"
+
+namespace
+{
+uint32_t bits(const float x)
+{
+  uint32_t u;
+  std::memcpy(&u, &x, sizeof(u));
+  return u;
+}
+
+float from_bits(const uint32_t u)
+{
+  float x;
+  std::memcpy(&x, &u, sizeof(x));
+  return x;
+}
+
+// After F. Giesen, "half_to_float" / "float_to_half_fast3_rtne"
+uint16_t float_to_fp16(const float x)
+{
+  const uint32_t f32_infinity = 255u << 23;
+  const uint32_t f16_max = (127u + 16u) << 23;
+  const uint32_t denorm_magic = ((127u - 15u) + (23u - 10u) + 1u) << 23;
+
+  uint32_t u = bits(x);
+  const uint32_t sign = u & 0x80000000u;
+  u ^= sign;
+  uint16_t result;
+  if (u >= f16_max) // Overflows to infinity, or is infinity or NaN
+    result = u > f32_infinity ? 0x7e00 : 0x7c00;
+  else if (u < (113u << 23)) // Subnormal or zero in fp16: let the FPU round it.
+    result = (uint16_t)(bits(from_bits(u) + from_bits(denorm_magic)) - denorm_magic);
+  else
+  {
+    const uint32_t mantissa_odd = (u >> 13) & 1;
+    u += ((uint32_t)(15 - 127) << 23) + 0xfff;
+    u += mantissa_odd;
+    result = (uint16_t)(u >> 13);
+  }
+  return result | (uint16_t)(sign >> 16);
+}
+
+float fp16_to_float(const uint16_t h)
+{
+  const uint32_t shifted_exponent = 0x7c00u << 13;
+  uint32_t u = ((uint32_t)h & 0x7fff) << 13;
+  const uint32_t exponent = shifted_exponent & u;
+  u += (127u - 15u) << 23;
+  if (exponent == shifted_exponent) // Infinity or NaN
+    u += (128u - 16u) << 23;
+  else if (exponent == 0) // Zero or subnormal
+  {
+    u += 1u << 23;
+    u = bits(from_bits(u) - from_bits(113u << 23));
+  }
+  return from_bits(u | ((uint32_t)h & 0x8000) << 16);
+}
+
+uint16_t float_to_bf16(const float x)
+{
+  const uint32_t u = bits(x);
+  if ((u & 0x7fffffffu) > 0x7f800000u) // Keep NaNs NaN
+    return (uint16_t)((u >> 16) | 0x40);
+  return (uint16_t)((u + 0x7fffu + ((u >> 16) & 1)) >> 16);
+}
+
+#ifdef NAM_HALF_PRECISION_X86
+// x86-64 always has SSE2, so that's the baseline. AVX2 and F16C convert 8 values at once (F16C in one instruction for
+// fp16), but builds don't target them by default, so unless they do, they're used if the CPU turns out to have them.
+  #if (defined(__AVX2__) && defined(__F16C__)) || (defined(_MSC_VER) && !defined(__clang__))
+    #define NAM_AVX2_FUNCTION
+  #else
+    #define NAM_AVX2_FUNCTION __attribute__((target("avx2,f16c")))
+  #endif
+
+bool has_avx2()
+{
+  #if defined(__AVX2__) && defined(__F16C__)
+  return true;
+  #elif defined(_MSC_VER) && !defined(__clang__)
+  static const bool result = [] {
+    int info[4];
+    __cpuid(info, 1);
+    // F16C, AVX, and the OS saving the AVX registers
+    const int needed = (1 << 29) | (1 << 28) | (1 << 27);
+    if ((info[2] & needed) != needed || (_xgetbv(0) & 6) != 6)
+      return false;
+    __cpuidex(info, 7, 0);
+    return (info[1] & (1 << 5)) != 0;
+  }();
+  return result;
+  #else
+  static const bool result = __builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c");
+  return result;
+  #endif
+}
+
+template <nam::WeightFormat Format>
+NAM_AVX2_FUNCTION inline __m256 load_avx2(const uint16_t* input)
+{
+  const __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input));
+  if constexpr (Format == nam::WeightFormat::kFloat16)
+    return _mm256_cvtph_ps(h);
+  else
+    return _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtepu16_epi32(h), 16));
+}
+
+// to_float() on the first n - n % 8 values; return how many that was.
+template <nam::WeightFormat Format>
+NAM_AVX2_FUNCTION size_t to_float_avx2(const uint16_t* input, const size_t n, float* output)
+{
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8)
+    _mm256_storeu_ps(output + i, load_avx2<Format>(input + i));
+  return i;
+}
+
+// multiply() on the first rows - rows % 8 rows; return how many that was.
+template <nam::WeightFormat Format>
+NAM_AVX2_FUNCTION long multiply_avx2(const uint16_t* matrix, const long rows, const long cols, const long ld,
+                                     const float* input, float* output)
+{
+  long i = 0;
+  for (; i + 8 <= rows; i += 8)
+  {
+    __m256 sum = _mm256_loadu_ps(output + i);
+    for (long j = 0; j < cols; j++)
+      sum = _mm256_add_ps(sum, _mm256_mul_ps(load_avx2<Format>(matrix + j * ld + i), _mm256_set1_ps(input[j])));
+    _mm256_storeu_ps(output + i, sum);
+  }
+  return i;
+}
+
+// fp16_to_float() on 4 values widened to 32 bits, without branches. Subnormals are still built by subtracting normal
+// floats, so denormals-are-zero mode doesn't flush them.
+__m128 fp16_to_float_sse2(const __m128i h)
+{
+  const __m128i shifted_exponent = _mm_set1_epi32(0x7c00 << 13);
+  __m128i u = _mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(0x7fff)), 13);
+  const __m128i exponent = _mm_and_si128(u, shifted_exponent);
+  u = _mm_add_epi32(u, _mm_set1_epi32((127 - 15) << 23));
+  const __m128i infinity_or_nan = _mm_cmpeq_epi32(exponent, shifted_exponent);
+  u = _mm_add_epi32(u, _mm_and_si128(infinity_or_nan, _mm_set1_epi32((128 - 16) << 23)));
+  const __m128i zero_or_subnormal = _mm_cmpeq_epi32(exponent, _mm_setzero_si128());
+  const __m128i subnormal = _mm_castps_si128(_mm_sub_ps(_mm_castsi128_ps(_mm_add_epi32(u, _mm_set1_epi32(1 << 23))),
+                                                        _mm_castsi128_ps(_mm_set1_epi32(113 << 23))));
+  u = _mm_or_si128(_mm_and_si128(zero_or_subnormal, subnormal), _mm_andnot_si128(zero_or_subnormal, u));
+  const __m128i sign = _mm_slli_epi32(_mm_and_si128(h, _mm_set1_epi32(0x8000)), 16);
+  return _mm_castsi128_ps(_mm_or_si128(u, sign));
+}
+#endif
+}; // namespace
+
+uint16_t nam::half_precision::from_float(const float x, const WeightFormat format)
+{
+  switch (format)
+  {
+    case WeightFormat::kFloat16: return float_to_fp16(x);
+    case WeightFormat::kBFloat16: return float_to_bf16(x);
+    default: throw std::runtime_error("Not a half-precision weight format");
+  }
+}
+
+float nam::half_precision::to_float(const uint16_t x, const WeightFormat format)
+{
+  switch (format)
+  {
+    case WeightFormat::kFloat16: return fp16_to_float(x);
+    case WeightFormat::kBFloat16: return from_bits((uint32_t)x << 16);
+    default: throw std::runtime_error("Not a half-precision weight format");
+  }
+}
+
+void nam::half_precision::to_float(const uint16_t* input, const size_t n, const WeightFormat format, float* output)
+{
+  size_t i = 0;
+#if defined(NAM_HALF_PRECISION_X86)
+  if (has_avx2())
+    i = format == WeightFormat::kFloat16 ? to_float_avx2<WeightFormat::kFloat16>(input, n, output)
+                                         : to_float_avx2<WeightFormat::kBFloat16>(input, n, output);
+#endif
+  if (format == WeightFormat::kFloat16)
+  {
+#if defined(NAM_HALF_PRECISION_X86)
+    for (; i + 8 <= n; i += 8)
+    {
+      const __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i));
+      _mm_storeu_ps(output + i, fp16_to_float_sse2(_mm_unpacklo_epi16(h, _mm_setzero_si128())));
+      _mm_storeu_ps(output + i + 4, fp16_to_float_sse2(_mm_unpackhi_epi16(h, _mm_setzero_si128())));
+    }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    for (; i + 4 <= n; i += 4)
+      vst1q_f32(output + i, vcvt_f32_f16(vreinterpret_f16_u16(vld1_u16(input + i))));
+#endif
+    for (; i < n; i++)
+      output[i] = fp16_to_float(input[i]);
+  }
+  else
+  {
+#if defined(NAM_HALF_PRECISION_X86)
+    // bfloat16 is the top half of a float32, so this is just interleaving with zeros.
+    for (; i + 8 <= n; i += 8)
+    {
+      const __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(input + i));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i), _mm_unpacklo_epi16(_mm_setzero_si128(), h));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(output + i + 4), _mm_unpackhi_epi16(_mm_setzero_si128(), h));
+    }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+    for (; i + 4 <= n; i += 4)
+      vst1q_u32(reinterpret_cast<uint32_t*>(output + i), vshll_n_u16(vld1_u16(input + i), 16));
+#endif
+    for (; i < n; i++)
+      output[i] = from_bits((uint32_t)input[i] << 16);
+  }
+}
+
+void nam::half_precision::multiply(const uint16_t* matrix, const long rows, const long cols, const long ld,
+                                   const WeightFormat format, const float* input, float* output)
+{
+  long i = 0;
+#if defined(NAM_HALF_PRECISION_X86)
+  if (has_avx2())
+    i = format == WeightFormat::kFloat16
+          ? multiply_avx2<WeightFormat::kFloat16>(matrix, rows, cols, ld, input, output)
+          : multiply_avx2<WeightFormat::kBFloat16>(matrix, rows, cols, ld, input, output);
+  for (; i + 8 <= rows; i += 8)
+  {
+    __m128 sum_lo = _mm_loadu_ps(output + i);
+    __m128 sum_hi = _mm_loadu_ps(output + i + 4);
+    for (long j = 0; j < cols; j++)
+    {
+      const __m128i h = _mm_loadu_si128(reinterpret_cast<const __m128i*>(matrix + j * ld + i));
+      __m128 lo, hi;
+      if (format == WeightFormat::kFloat16)
+      {
+        lo = fp16_to_float_sse2(_mm_unpacklo_epi16(h, _mm_setzero_si128()));
+        hi = fp16_to_float_sse2(_mm_unpackhi_epi16(h, _mm_setzero_si128()));
+      }
+      else
+      {
+        lo = _mm_castsi128_ps(_mm_unpacklo_epi16(_mm_setzero_si128(), h));
+        hi = _mm_castsi128_ps(_mm_unpackhi_epi16(_mm_setzero_si128(), h));
+      }
+      const __m128 x = _mm_set1_ps(input[j]);
+      sum_lo = _mm_add_ps(sum_lo, _mm_mul_ps(lo, x));
+      sum_hi = _mm_add_ps(sum_hi, _mm_mul_ps(hi, x));
+    }
+    _mm_storeu_ps(output + i, sum_lo);
+    _mm_storeu_ps(output + i + 4, sum_hi);
+  }
+#elif defined(__aarch64__) && defined(__ARM_NEON)
+  for (; i + 4 <= rows; i += 4)
+  {
+    float32x4_t sum = vld1q_f32(output + i);
+    for (long j = 0; j < cols; j++)
+    {
+      const uint16x4_t h = vld1_u16(matrix + j * ld + i);
+      const float32x4_t x = format == WeightFormat::kFloat16 ? vcvt_f32_f16(vreinterpret_f16_u16(h))
+                                                             : vreinterpretq_f32_u32(vshll_n_u16(h, 16));
+      sum = vmlaq_n_f32(sum, x, input[j]);
+    }
+    vst1q_f32(output + i, sum);
+  }
+#endif
+  for (; i < rows; i++)
+    for (long j = 0; j < cols; j++)
+      output[i] += to_float(matrix[j * ld + i], format) * input[j];
+}
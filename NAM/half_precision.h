@@ -0,0 +1,40 @@
+#pragma once
+// Half-precision weight storage
+//
+// The big weight matrices (convolutions, LSTM gates, linear taps) can be stored as 16-bit floats, halving the memory
+// they take and the bandwidth it takes to stream them through the cache. Everything is still computed in float32,
+// converting as the kernels go (see PackedWeights::multiply_()): a matrix times a vector converts the weights in
+// registers on their way into the sums, and a matrix times a matrix converts a panel at a time into a small buffer on
+// the stack, which stays in L1.
+//
+// Two formats:
+// * kFloat16: IEEE binary16. 11 bits of precision, range up to 65504. The better choice for NAM weights.
+// * kBFloat16: the top half of a float32. 8 bits of precision, the full float32 range.
+//
+// Conversion uses AVX2/F16C on x86-64 when the CPU has them and SSE2 when it doesn't, NEON on AArch64, and plain C++
+// otherwise.
+
+#include <cstddef>
+#include <cstdint>
+
+namespace nam
+{
+enum class WeightFormat
+{
+  kFloat32 = 0,
+  kFloat16,
+  kBFloat16
+};
+
+namespace half_precision
+{
+// Round to the nearest representable value (ties to even).
+uint16_t from_float(const float x, const WeightFormat format);
+float to_float(const uint16_t x, const WeightFormat format);
+// Convert n values
+void to_float(const uint16_t* input, const size_t n, const WeightFormat format, float* output);
+// output += matrix * input, where the matrix is stored column by column, `ld` values apart, converting as it goes
+void multiply(const uint16_t* matrix, const long rows, const long cols, const long ld, const WeightFormat format,
+              const float* input, float* output);
+}; // namespace half_precision
+}; // namespace nam
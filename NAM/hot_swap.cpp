@@ -0,0 +1,229 @@
+#include <algorithm>
+#include <chrono>
+#include <exception>
+#include <stdexcept>
+
+#include "hot_swap.h"
+
+nam::HotSwapDSP::HotSwapDSP(const int max_block_size, const int crossfade_samples)
+: DSP(NAM_UNKNOWN_EXPECTED_SAMPLE_RATE)
+, _crossfade_samples(crossfade_samples)
+{
+  if (max_block_size <= 0)
+    throw std::runtime_error("HotSwapDSP needs a positive maximum block size");
+  this->prepare(max_block_size);
+  this->_thread = std::thread(&HotSwapDSP::_run, this);
+}
+
+nam::HotSwapDSP::~HotSwapDSP()
+{
+  {
+    std::lock_guard<std::mutex> lock(this->_mutex);
+    this->_stop = true;
+  }
+  this->_condition.notify_one();
+  this->_thread.join();
+  this->_destroy_retired();
+  delete this->_incoming.exchange(nullptr);
+  delete this->_retire_pending;
+  if (this->_fading_out_active)
+    delete this->_fading_out;
+  delete this->_current;
+}
+
+void nam::HotSwapDSP::load_async(const std::filesystem::path& model_file)
+{
+  {
+    std::lock_guard<std::mutex> lock(this->_mutex);
+    this->_request = model_file;
+  }
+  this->_condition.notify_one();
+}
+
+void nam::HotSwapDSP::set_model(std::unique_ptr<DSP> model)
+{
+  this->_publish(std::move(model));
+}
+
+void nam::HotSwapDSP::set_crossfade_samples(const int crossfade_samples)
+{
+  this->_crossfade_samples.store(std::max(crossfade_samples, 0), std::memory_order_relaxed);
+}
+
+std::optional<std::string> nam::HotSwapDSP::get_load_error()
+{
+  std::lock_guard<std::mutex> lock(this->_mutex);
+  std::optional<std::string> error = std::move(this->_load_error);
+  this->_load_error.reset();
+  return error;
+}
+
+void nam::HotSwapDSP::process(const float* input, float* output, const int num_frames)
+{
+  this->_process(input, output, num_frames);
+}
+
+void nam::HotSwapDSP::process(const double* input, double* output, const int num_frames)
+{
+  this->_process(input, output, num_frames);
+}
+
+template <typename Sample>
+void nam::HotSwapDSP::_process(const Sample* input, Sample* output, const int num_frames)
+{
+  if (this->_retire_pending != nullptr && this->_retire(this->_retire_pending))
+    this->_retire_pending = nullptr;
+
+  // Pick up a new model, unless we're still busy getting rid of the last one.
+  if (!this->_fading_out_active && this->_retire_pending == nullptr)
+  {
+    DSP* incoming = this->_incoming.exchange(nullptr, std::memory_order_acquire);
+    if (incoming != nullptr)
+    {
+      this->_fading_out = this->_current;
+      this->_fading_out_active = true;
+      this->_current = incoming;
+      this->_crossfade_length = this->_crossfade_samples.load(std::memory_order_relaxed);
+      this->_crossfade_position = 0;
+    }
+  }
+
+  if (!this->_fading_out_active)
+  {
+    _process_model(this->_current, input, output, num_frames);
+    return;
+  }
+
+  // Only a host that breaks its promise about block sizes gets more than one block here.
+  Scratch<Sample>& scratch = std::get<Scratch<Sample>>(this->_scratch);
+  const int block_size = (int)scratch.input.size();
+  for (int start = 0; start < num_frames; start += block_size)
+  {
+    const int n = std::min(block_size, num_frames - start);
+    if (!this->_fading_out_active)
+    {
+      _process_model(this->_current, input + start, output + start, n);
+      continue;
+    }
+    // Both models need the input, and the host may have given us the same buffer for input and output.
+    std::copy(input + start, input + start + n, scratch.input.begin());
+    _process_model(this->_fading_out, scratch.input.data(), scratch.fade.data(), n);
+    _process_model(this->_current, scratch.input.data(), output + start, n);
+    for (int i = 0; i < n; i++)
+    {
+      const int position = this->_crossfade_position + i;
+      const Sample gain =
+        position >= this->_crossfade_length ? 1.0 : (Sample)(position + 1) / (this->_crossfade_length + 1);
+      output[start + i] = gain * output[start + i] + ((Sample)1.0 - gain) * scratch.fade[i];
+    }
+    this->_crossfade_position += n;
+    if (this->_crossfade_position >= this->_crossfade_length)
+    {
+      if (this->_fading_out != nullptr && !this->_retire(this->_fading_out))
+        this->_retire_pending = this->_fading_out;
+      this->_fading_out = nullptr;
+      this->_fading_out_active = false;
+    }
+  }
+}
+
+void nam::HotSwapDSP::finalize_(const int num_frames)
+{
+  this->DSP::finalize_(num_frames);
+}
+
+void nam::HotSwapDSP::_prepare_(const int max_num_frames)
+{
+  std::lock_guard<std::mutex> lock(this->_prepare_mutex);
+  this->_max_num_frames = std::max(this->_max_num_frames, max_num_frames);
+  const auto resize = [this](auto& scratch) {
+    scratch.input.resize(this->_max_num_frames);
+    scratch.fade.resize(this->_max_num_frames);
+  };
+  resize(std::get<Scratch<float>>(this->_scratch));
+  resize(std::get<Scratch<double>>(this->_scratch));
+  // The audio thread isn't running, and _publish() can't hand over another model while we hold the lock.
+  for (DSP* model : {this->_current, this->_fading_out_active ? this->_fading_out : nullptr,
+                     this->_incoming.load(std::memory_order_acquire)})
+    if (model != nullptr)
+      model->prepare(this->_max_num_frames);
+}
+
+void nam::HotSwapDSP::_run()
+{
+  while (true)
+  {
+    std::optional<std::filesystem::path> request;
+    {
+      std::unique_lock<std::mutex> lock(this->_mutex);
+      // Wake up now and then even without a request, to free whatever the audio thread retired.
+      this->_condition.wait_for(
+        lock, std::chrono::milliseconds(50), [this] { return this->_stop || this->_request.has_value(); });
+      if (this->_stop)
+        return;
+      request.swap(this->_request);
+    }
+    this->_destroy_retired();
+    if (!request.has_value())
+      continue;
+    try
+    {
+      // get_dsp() also prewarms.
+      this->_publish(get_dsp(*request));
+    }
+    catch (const std::exception& e)
+    {
+      std::lock_guard<std::mutex> lock(this->_mutex);
+      this->_load_error = e.what();
+    }
+  }
+}
+
+void nam::HotSwapDSP::_publish(std::unique_ptr<DSP> model)
+{
+  DSP* replaced;
+  {
+    std::lock_guard<std::mutex> lock(this->_prepare_mutex);
+    if (model != nullptr)
+      model->prepare(this->_max_num_frames);
+    replaced = this->_incoming.exchange(model.release(), std::memory_order_acq_rel);
+  }
+  // If the audio thread never picked up the previous one, it's ours to get rid of.
+  delete replaced;
+}
+
+void nam::HotSwapDSP::_destroy_retired()
+{
+  int tail = this->_retired_tail.load(std::memory_order_relaxed);
+  const int head = this->_retired_head.load(std::memory_order_acquire);
+  for (; tail != head; tail = (tail + 1) % kRetireCapacity)
+  {
+    delete this->_retired[tail];
+    this->_retired[tail] = nullptr;
+  }
+  this->_retired_tail.store(tail, std::memory_order_release);
+}
+
+bool nam::HotSwapDSP::_retire(DSP* model)
+{
+  const int head = this->_retired_head.load(std::memory_order_relaxed);
+  const int next = (head + 1) % kRetireCapacity;
+  if (next == this->_retired_tail.load(std::memory_order_acquire))
+    return false;
+  this->_retired[head] = model;
+  this->_retired_head.store(next, std::memory_order_release);
+  return true;
+}
+
+template <typename Sample>
+void nam::HotSwapDSP::_process_model(DSP* model, const Sample* input, Sample* output, const int num_frames)
+{
+  if (model == nullptr)
+  {
+    if (output != input)
+      std::copy(input, input + num_frames, output);
+    return;
+  }
+  model->process(input, output, num_frames);
+  model->finalize_(num_frames);
+}
@@ -0,0 +1,114 @@
+#pragma once
+// Glitch-free model changes
+//
+// HotSwapDSP is a DSP that wraps whichever model is currently active. New models are loaded (and prewarmed) on a
+// background thread and handed to the audio thread through a lock-free slot. The audio thread then crossfades from
+// the old model to the new one, and passes the old model back to the background thread to be destroyed. Every model is
+// prepared for the largest block the host will send before the audio thread sees it, so process() never does file
+// I/O, parsing, allocation or deallocation.
+//
+// Until the first model arrives, audio passes through unchanged.
+
+#include <atomic>
+#include <condition_variable>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+#include "dsp.h"
+
+namespace nam
+{
+class HotSwapDSP : public DSP
+{
+public:
+  // `max_block_size` is the most frames the host will ever pass to process() at once (as for prepare(), which can raise
+  // it later). Throws std::runtime_error if it isn't positive.
+  HotSwapDSP(const int max_block_size, const int crossfade_samples = 2048);
+  ~HotSwapDSP();
+
+  // Non-realtime threads =====================================================
+
+  // Start loading a model in the background. If another load is still queued, it is replaced by this one.
+  void load_async(const std::filesystem::path& model_file);
+  // Hand over a model that's already been built (and prewarmed).
+  void set_model(std::unique_ptr<DSP> model);
+  // How long crossfades between models take. Takes effect from the next swap.
+  void set_crossfade_samples(const int crossfade_samples);
+  // The message of the last background load that failed, if there was one since the last call.
+  std::optional<std::string> get_load_error();
+
+  // Audio thread =============================================================
+
+  // Crossfades happen in the host's sample type, and passing through before the first model is exact.
+  void process(const float* input, float* output, const int num_frames) override;
+  void process(const double* input, double* output, const int num_frames) override;
+  // The wrapped models are finalized inside process(), so there's nothing else to do here.
+  void finalize_(const int num_frames) override;
+  // Whether a crossfade is under way
+  bool is_crossfading() const { return this->_fading_out_active; };
+
+protected:
+  // Prepares the models we have now, including one that's waiting to be picked up (so, like prepare() itself, not
+  // while process() might be running), and the ones that arrive later before they're handed to the audio thread.
+  void _prepare_(const int max_num_frames) override;
+
+private:
+  // Room for models waiting to be destroyed
+  static constexpr int kRetireCapacity = 8;
+
+  // Owned by the audio thread. nullptr means "pass through".
+  DSP* _current = nullptr;
+  DSP* _fading_out = nullptr;
+  bool _fading_out_active = false;
+  int _crossfade_length = 0;
+  int _crossfade_position = 0;
+  std::atomic<int> _crossfade_samples;
+  // What models are prepared for. Held while preparing a model and handing it over, so that a prepare() can't slip in
+  // between the two.
+  std::mutex _prepare_mutex;
+  int _max_num_frames = 0;
+  // A model that finished fading out but didn't fit in the retire queue yet
+  DSP* _retire_pending = nullptr;
+  // For crossfading, _max_num_frames long
+  template <typename Sample>
+  struct Scratch
+  {
+    std::vector<Sample> input;
+    std::vector<Sample> fade;
+  };
+  // One set for each sample type
+  std::tuple<Scratch<float>, Scratch<double>> _scratch;
+
+  // Background thread -> audio thread
+  std::atomic<DSP*> _incoming{nullptr};
+  // Audio thread -> background thread (single producer, single consumer)
+  DSP* _retired[kRetireCapacity] = {};
+  std::atomic<int> _retired_head{0};
+  std::atomic<int> _retired_tail{0};
+
+  // The background thread and what it's asked to do
+  std::mutex _mutex;
+  std::condition_variable _condition;
+  std::optional<std::filesystem::path> _request;
+  std::optional<std::string> _load_error;
+  bool _stop = false;
+  std::thread _thread;
+
+  void _run();
+  void _publish(std::unique_ptr<DSP> model);
+  void _destroy_retired();
+  // Audio thread: returns false if the queue is full.
+  bool _retire(DSP* model);
+  template <typename Sample>
+  void _process(const Sample* input, Sample* output, const int num_frames);
+  // Run `model` (or pass through, if it's nullptr) on one block.
+  template <typename Sample>
+  static void _process_model(DSP* model, const Sample* input, Sample* output, const int num_frames);
+};
+}; // namespace nam
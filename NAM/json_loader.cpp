@@ -0,0 +1,243 @@
+#include <algorithm>
+#include <charconv>
+#include <clocale>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+#include "json.hpp"
+#include "json_loader.h"
+
+namespace
+{
+bool is_whitespace(const char c)
+{
+  return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+// Walks over the top level of a JSON object.
+class Scanner
+{
+public:
+  Scanner(const char* data, const size_t size)
+  : _pos(data)
+  , _end(data + size){};
+
+  void skip_whitespace()
+  {
+    while (this->_pos < this->_end && is_whitespace(*this->_pos))
+      this->_pos++;
+  };
+  // Consume `c` (after any whitespace) or throw.
+  void expect(const char c)
+  {
+    this->skip_whitespace();
+    if (this->_pos >= this->_end || *this->_pos != c)
+      this->_fail(std::string("expected '") + c + "'");
+    this->_pos++;
+  };
+  // Consume `c` (after any whitespace) if it's next.
+  bool accept(const char c)
+  {
+    this->skip_whitespace();
+    if (this->_pos < this->_end && *this->_pos == c)
+    {
+      this->_pos++;
+      return true;
+    }
+    return false;
+  };
+  // Reads a string token, unescaping it if needed.
+  std::string read_string()
+  {
+    this->skip_whitespace();
+    const char* start = this->_pos;
+    this->_skip_string();
+    if (std::find(start, this->_pos, '\\') == this->_pos)
+      return std::string(start + 1, this->_pos - 1);
+    return nlohmann::json::parse(start, this->_pos).get<std::string>();
+  };
+  // Skips over any JSON value and returns the text it occupied.
+  std::pair<const char*, const char*> skip_value()
+  {
+    this->skip_whitespace();
+    const char* start = this->_pos;
+    int depth = 0;
+    do
+    {
+      if (this->_pos >= this->_end)
+        this->_fail("unexpected end of file");
+      const char c = *this->_pos;
+      if (c == '"')
+        this->_skip_string();
+      else
+      {
+        if (c == '{' || c == '[')
+          depth++;
+        else if (c == '}' || c == ']')
+          depth--;
+        this->_pos++;
+        // Scalars at the top of the value end at the next delimiter.
+        if (depth == 0 && c != '}' && c != ']')
+          while (this->_pos < this->_end && !is_whitespace(*this->_pos) && *this->_pos != ','
+                 && *this->_pos != '}' && *this->_pos != ']')
+            this->_pos++;
+      }
+    } while (depth > 0);
+    return std::make_pair(start, this->_pos);
+  };
+  // Reads an array of numbers into `weights`, which is sized before anything is parsed.
+  void read_weights(std::vector<float>& weights)
+  {
+    this->expect('[');
+    // Only numbers in here, so the first ']' closes the array and each ',' separates two weights.
+    const char* close = (const char*)std::memchr(this->_pos, ']', this->_end - this->_pos);
+    if (close == nullptr)
+      this->_fail("unterminated weights array");
+    weights.clear();
+    if (this->accept(']'))
+      return;
+    weights.reserve(std::count(this->_pos, close, ',') + 1);
+    do
+    {
+      this->skip_whitespace();
+      weights.push_back((float)this->_read_double(close));
+    } while (this->accept(','));
+    this->expect(']');
+  };
+  // Skips an array of numbers without parsing them, and returns how many there were.
+  size_t skip_weights()
+  {
+    this->expect('[');
+    const char* close = (const char*)std::memchr(this->_pos, ']', this->_end - this->_pos);
+    if (close == nullptr)
+      this->_fail("unterminated weights array");
+    if (this->accept(']'))
+      return 0;
+    const size_t count = std::count(this->_pos, close, ',') + 1;
+    this->_pos = close + 1;
+    return count;
+  };
+
+private:
+  const char* _pos;
+  const char* _end;
+
+  [[noreturn]] void _fail(const std::string& what) const
+  {
+    throw std::runtime_error("Malformed model file: " + what);
+  };
+  void _skip_string()
+  {
+    if (this->_pos >= this->_end || *this->_pos != '"')
+      this->_fail("expected a string");
+    for (this->_pos++; this->_pos < this->_end; this->_pos++)
+    {
+      if (*this->_pos == '\\')
+        this->_pos++;
+      else if (*this->_pos == '"')
+      {
+        this->_pos++;
+        return;
+      }
+    }
+    this->_fail("unterminated string");
+  };
+  // Parses a number ending before `last`.
+  // Goes through double (and lets the caller round to float) so that the result matches what nlohmann::json gives.
+  double _read_double(const char* last)
+  {
+    double value = 0.0;
+#if defined(__cpp_lib_to_chars) && __cpp_lib_to_chars >= 201611L
+    const std::from_chars_result result = std::from_chars(this->_pos, last, value);
+    if (result.ec == std::errc())
+    {
+      this->_pos = result.ptr;
+      return value;
+    }
+    // Fall through for e.g. subnormals, which some implementations report as out of range.
+#endif
+    // Like nlohmann::json does it: copy the token and swap in the locale's decimal point for strtod().
+    char buffer[64];
+    size_t length = 0;
+    const std::lconv* loc = std::localeconv();
+    const char decimal_point = (loc->decimal_point == nullptr) ? '.' : *(loc->decimal_point);
+    for (const char* p = this->_pos; p < last && length < sizeof(buffer) - 1; p++, length++)
+    {
+      const char c = *p;
+      if (!((c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E'))
+        break;
+      buffer[length] = c == '.' ? decimal_point : c;
+    }
+    buffer[length] = '\0';
+    char* parse_end = nullptr;
+    value = std::strtod(buffer, &parse_end);
+    if (parse_end == buffer)
+      this->_fail("expected a number in the weights");
+    this->_pos += parse_end - buffer;
+    return value;
+  };
+};
+
+// Returns the number of weights in the file. They're only read into `model` if `read_weights` is set.
+size_t parse_model(const char* data, const size_t size, nam::dspData& model, const bool read_weights)
+{
+  Scanner scanner(data, size);
+  // Everything but the weights
+  nlohmann::json j = nlohmann::json::object();
+  bool have_weights = false;
+  size_t num_weights = 0;
+
+  scanner.expect('{');
+  if (!scanner.accept('}'))
+  {
+    do
+    {
+      const std::string key = scanner.read_string();
+      scanner.expect(':');
+      if (key == "weights")
+      {
+        if (read_weights)
+        {
+          scanner.read_weights(model.weights);
+          num_weights = model.weights.size();
+        }
+        else
+          num_weights = scanner.skip_weights();
+        have_weights = true;
+      }
+      else
+      {
+        const std::pair<const char*, const char*> value = scanner.skip_value();
+        j[key] = nlohmann::json::parse(value.first, value.second);
+      }
+    } while (scanner.accept(','));
+    scanner.expect('}');
+  }
+
+  if (!have_weights)
+    throw std::runtime_error("Corrupted model file is missing weights.");
+  if (j.find("version") == j.end() || j.find("architecture") == j.end() || j.find("config") == j.end())
+    throw std::runtime_error("Corrupted model file is missing its version, architecture or config.");
+  model.version = j["version"];
+  model.architecture = j["architecture"];
+  model.config = std::move(j["config"]);
+  model.metadata = std::move(j["metadata"]);
+  if (j.find("sample_rate") != j.end())
+    model.expected_sample_rate = j["sample_rate"];
+  else
+    model.expected_sample_rate = -1.0;
+  return num_weights;
+}
+}; // namespace
+
+void nam::json_loader::parse(const char* data, const size_t size, dspData& model)
+{
+  parse_model(data, size, model, true);
+}
+
+size_t nam::json_loader::parse_header(const char* data, const size_t size, dspData& model)
+{
+  return parse_model(data, size, model, false);
+}
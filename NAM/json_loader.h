@@ -0,0 +1,24 @@
+#pragma once
+// Loader for .nam (JSON) model files
+//
+// The "weights" array is by far the largest part of a .nam file. Parsing it into a nlohmann::json DOM first means one
+// heap-allocated node per weight, so instead the loader scans the top level of the file itself. Weights are parsed
+// straight into a float array that is sized up front, and only the small values ("config", "metadata", ...) are handed
+// to nlohmann::json.
+
+#include <cstddef>
+
+#include "dsp.h"
+
+namespace nam
+{
+namespace json_loader
+{
+// Parses the text of a .nam file into `model`.
+// Throws std::runtime_error if the text is malformed or required fields are missing.
+void parse(const char* data, const size_t size, dspData& model);
+// Like parse(), but skips over the weights instead of reading them, leaving `model.weights` empty.
+// Returns the number of weights in the file.
+size_t parse_header(const char* data, const size_t size, dspData& model);
+}; // namespace json_loader
+}; // namespace nam
@@ -0,0 +1,48 @@
+#include <cmath>
+
+#include "low_rank.h"
+
+nam::LowRankMatrix::LowRankMatrix(const Eigen::Ref<const Eigen::MatrixXf>& weights, const float max_error)
+{
+  const long rows = weights.rows();
+  const long cols = weights.cols();
+  if (rows == 0 || cols == 0)
+    return;
+  // In double, so that the small singular values that decide the rank are accurate
+  const Eigen::MatrixXd w = weights.cast<double>();
+  Eigen::JacobiSVD<Eigen::MatrixXd> svd(w, Eigen::ComputeThinU | Eigen::ComputeThinV);
+  const Eigen::VectorXd& s = svd.singularValues();
+  const double total = s.squaredNorm();
+  // Walk back from full rank while dropping the next singular value keeps us within the bound
+  const double budget = (double)max_error * max_error * total;
+  long rank = s.size();
+  double dropped = 0.0;
+  while (rank > 0 && dropped + s(rank - 1) * s(rank - 1) <= budget)
+  {
+    dropped += s(rank - 1) * s(rank - 1);
+    rank--;
+  }
+  this->_rank = rank;
+  this->_error = total > 0.0 ? (float)std::sqrt(dropped / total) : 0.0f;
+  if (rank * (rows + cols) >= rows * cols)
+    return; // Not worth it
+  this->_u = (svd.matrixU().leftCols(rank) * s.head(rank).asDiagonal()).cast<float>();
+  this->_v = svd.matrixV().leftCols(rank).transpose().cast<float>();
+  this->_factored = true;
+}
+
+void nam::LowRankMatrix::multiply_(const Eigen::Ref<const Eigen::MatrixXf>& input,
+                                   Eigen::Ref<Eigen::MatrixXf> output) const
+{
+  if (this->_scratch.cols() < input.cols())
+    this->_scratch.resize(this->_rank, input.cols());
+  auto scratch = this->_scratch.leftCols(input.cols());
+  scratch.noalias() = this->_v * input;
+  output.noalias() = this->_u * scratch;
+}
+
+void nam::LowRankMatrix::reserve_(const long num_frames)
+{
+  if (this->_scratch.cols() < num_frames)
+    this->_scratch.resize(this->_rank, num_frames);
+}
@@ -0,0 +1,57 @@
+#pragma once
+// Low-rank 1x1 convolutions
+//
+// The 1x1 convolutions of wider WaveNets are often close to low-rank. LowRankMatrix factors one with an SVD at load
+// time and keeps it as U * V, with the singular values folded into U, at the smallest rank whose reconstruction error
+// is within a given bound. Multiplying a (rows, cols) matrix with rank r that way takes r * (rows + cols) multiply-adds
+// per frame instead of rows * cols, so it's only worth it when r is small enough. See DSP::factorize_low_rank().
+
+#include <string>
+
+#include <Eigen/Dense>
+
+namespace nam
+{
+class LowRankMatrix
+{
+public:
+  LowRankMatrix() = default;
+  // Find the smallest rank at which `weights` is within `max_error` (the Frobenius norm of the difference, relative to
+  // that of `weights`) and factor it at that rank, if that takes fewer multiply-adds. Otherwise this stays empty.
+  LowRankMatrix(const Eigen::Ref<const Eigen::MatrixXf>& weights, const float max_error);
+
+  // Whether `weights` was factored (empty ones stand for "use the dense weights")
+  bool empty() const { return !this->_factored; };
+  // The rank needed to get within the bound, whether or not it was worth factoring at
+  long rank() const { return this->_rank; };
+  // The relative error at that rank
+  float get_error() const { return this->_error; };
+  // output = U * (V * input). Allocates if `input` has more frames than ever before (see reserve_()).
+  void multiply_(const Eigen::Ref<const Eigen::MatrixXf>& input, Eigen::Ref<Eigen::MatrixXf> output) const;
+  // Make room to multiply up to `num_frames` frames at a time without allocating
+  void reserve_(const long num_frames);
+
+private:
+  bool _factored = false;
+  long _rank = 0;
+  float _error = 0.0f;
+  // (rows, rank) and (rank, cols)
+  Eigen::MatrixXf _u;
+  Eigen::MatrixXf _v;
+  // V * input
+  mutable Eigen::MatrixXf _scratch;
+};
+
+// What DSP::factorize_low_rank() did with one matrix
+struct LowRankReport
+{
+  // Which one, e.g. "layer_arrays[0].layers[3]._1x1"
+  std::string name;
+  long rows;
+  long cols;
+  // See LowRankMatrix
+  long rank;
+  float error;
+  bool factored;
+};
+}; // namespace nam
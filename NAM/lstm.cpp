@@ -4,7 +4,7 @@
 
 #include "lstm.h"
 
-nam::lstm::LSTMCell::LSTMCell(const int input_size, const int hidden_size, std::vector<float>::iterator& weights)
+nam::lstm::LSTMCell::LSTMCell(const int input_size, const int hidden_size, weights_it& weights)
 {
   // Resize arrays
   this->_w.resize(4 * hidden_size, input_size + hidden_size);
@@ -16,9 +16,9 @@ nam::lstm::LSTMCell::LSTMCell(const int input_size, const int hidden_size, std::
   // Assign in row-major because that's how PyTorch goes.
   for (int i = 0; i < this->_w.rows(); i++)
     for (int j = 0; j < this->_w.cols(); j++)
-      this->_w(i, j) = *(weights++);
+      this->_w.get_()(i, j) = *(weights++);
   for (int i = 0; i < this->_b.size(); i++)
-    this->_b[i] = *(weights++);
+    this->_b.get_()(i) = *(weights++);
   const int h_offset = input_size;
   for (int i = 0; i < hidden_size; i++)
     this->_xh[i + h_offset] = *(weights++);
@@ -26,14 +26,18 @@ nam::lstm::LSTMCell::LSTMCell(const int input_size, const int hidden_size, std::
     this->_c[i] = *(weights++);
 }
 
-void nam::lstm::LSTMCell::process_(const Eigen::VectorXf& x)
+void nam::lstm::LSTMCell::process_(const Eigen::Ref<const Eigen::VectorXf>& x)
 {
   const long hidden_size = this->_get_hidden_size();
   const long input_size = this->_get_input_size();
   // Assign inputs
   this->_xh(Eigen::seq(0, input_size - 1)) = x;
   // The matmul
-  this->_ifgo = this->_w * this->_xh + this->_b;
+  if (this->_w_sparse.empty())
+    this->_w.multiply_(this->_xh, this->_ifgo, false);
+  else
+    this->_w_sparse.multiply_(this->_xh, this->_ifgo, false);
+  this->_ifgo += this->_b.view();
   // Elementwise updates (apply nonlinearities here)
   const long i_offset = 0;
   const long f_offset = hidden_size;
@@ -63,27 +67,61 @@ void nam::lstm::LSTMCell::process_(const Eigen::VectorXf& x)
   }
 }
 
-nam::lstm::LSTM::LSTM(const int num_layers, const int input_size, const int hidden_size, std::vector<float>& weights,
+void nam::lstm::LSTMCell::pack_(WeightArena& arena)
+{
+  this->_w.pack_(arena, true);
+  this->_b.pack_(arena);
+}
+
+int nam::lstm::LSTMCell::sparsify_(const float threshold)
+{
+  const auto w = this->_w.to_float();
+  if (SparseMatrix::get_sparsity(w) < threshold)
+  {
+    this->_w_sparse = SparseMatrix();
+    return 0;
+  }
+  this->_w_sparse = SparseMatrix(w);
+  return 1;
+}
+
+nam::lstm::LSTM::LSTM(const int num_layers, const int input_size, const int hidden_size, std::span<const float> weights,
                       const double expected_sample_rate)
 : DSP(expected_sample_rate)
 {
   this->_input.resize(1);
-  std::vector<float>::iterator it = weights.begin();
+  weights_it it = weights.begin();
+  this->_layers.reserve(num_layers);
   for (int i = 0; i < num_layers; i++)
-    this->_layers.push_back(LSTMCell(i == 0 ? input_size : hidden_size, hidden_size, it));
+    this->_layers.emplace_back(i == 0 ? input_size : hidden_size, hidden_size, it);
   this->_head_weight.resize(hidden_size);
   for (int i = 0; i < hidden_size; i++)
-    this->_head_weight[i] = *(it++);
+    this->_head_weight.get_()(i) = *(it++);
   this->_head_bias = *(it++);
   assert(it == weights.end());
 }
 
-void nam::lstm::LSTM::process(NAM_SAMPLE* input, NAM_SAMPLE* output, const int num_frames)
+void nam::lstm::LSTM::_process_(const float* input, float* output, const int num_frames)
 {
   for (size_t i = 0; i < num_frames; i++)
     output[i] = this->_process_sample(input[i]);
 }
 
+void nam::lstm::LSTM::_pack_weights_(WeightArena& arena)
+{
+  for (auto& layer : this->_layers)
+    layer.pack_(arena);
+  this->_head_weight.pack_(arena);
+}
+
+int nam::lstm::LSTM::_sparsify_(const float threshold)
+{
+  int num_sparse = 0;
+  for (auto& layer : this->_layers)
+    num_sparse += layer.sparsify_(threshold);
+  return num_sparse;
+}
+
 float nam::lstm::LSTM::_process_sample(const float x)
 {
   if (this->_layers.size() == 0)
@@ -92,5 +130,6 @@ float nam::lstm::LSTM::_process_sample(const float x)
   this->_layers[0].process_(this->_input);
   for (size_t i = 1; i < this->_layers.size(); i++)
     this->_layers[i].process_(this->_layers[i - 1].get_hidden_state());
-  return this->_head_weight.dot(this->_layers[this->_layers.size() - 1].get_hidden_state()) + this->_head_bias;
+  return this->_head_weight.view().dot(this->_layers[this->_layers.size() - 1].get_hidden_state())
+         + this->_head_bias;
 }
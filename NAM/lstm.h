@@ -22,16 +22,21 @@ namespace lstm
 class LSTMCell
 {
 public:
-  LSTMCell(const int input_size, const int hidden_size, std::vector<float>::iterator& weights);
-  Eigen::VectorXf get_hidden_state() const { return this->_xh(Eigen::placeholders::lastN(this->_get_hidden_size())); };
-  void process_(const Eigen::VectorXf& x);
+  LSTMCell(const int input_size, const int hidden_size, weights_it& weights);
+  Eigen::Ref<const Eigen::VectorXf> get_hidden_state() const { return this->_xh.tail(this->_get_hidden_size()); };
+  void process_(const Eigen::Ref<const Eigen::VectorXf>& x);
+  void pack_(WeightArena& arena);
+  // Use a sparse copy of _w if it's sparse enough. Returns 1 if it is.
+  int sparsify_(const float threshold);
 
 private:
   // Parameters
   // xh -> ifgo
   // (dx+dh) -> (4*dh)
-  Eigen::MatrixXf _w;
-  Eigen::VectorXf _b;
+  PackedMatrix _w;
+  PackedVector _b;
+  // Empty unless sparse
+  SparseMatrix _w_sparse;
 
   // State
   // Concatenated input and hidden state
@@ -50,14 +55,16 @@ private:
 class LSTM : public DSP
 {
 public:
-  LSTM(const int num_layers, const int input_size, const int hidden_size, std::vector<float>& weights,
+  LSTM(const int num_layers, const int input_size, const int hidden_size, std::span<const float> weights,
        const double expected_sample_rate = -1.0);
   ~LSTM() = default;
 
 protected:
-  Eigen::VectorXf _head_weight;
+  PackedVector _head_weight;
   float _head_bias;
-  void process(NAM_SAMPLE* input, NAM_SAMPLE* output, const int num_frames) override;
+  void _process_(const float* input, float* output, const int num_frames) override;
+  void _pack_weights_(WeightArena& arena) override;
+  int _sparsify_(const float threshold) override;
   std::vector<LSTMCell> _layers;
 
   float _process_sample(const float x);
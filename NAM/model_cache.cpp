@@ -0,0 +1,240 @@
+#include <cstring>
+#include <stdexcept>
+#include <system_error>
+
+#include "binary_model.h"
+#include "json_loader.h"
+#include "model_cache.h"
+#include "util.h"
+
+namespace
+{
+// SHA-256 (FIPS 180-4). A cache hit hands back a model without looking at the file again, so files that hash the same
+// have to be the same file; a 64-bit hash doesn't make that sure enough.
+class Sha256
+{
+public:
+  static nam::ModelCache::Digest hash(const char* data, const size_t size)
+  {
+    Sha256 sha;
+    size_t i = 0;
+    for (; i + 64 <= size; i += 64)
+      sha._block(reinterpret_cast<const unsigned char*>(data) + i);
+    // The rest, a 1 bit, zeros, and the length in bits, in one or two more blocks
+    unsigned char tail[128] = {};
+    const size_t rest = size - i;
+    std::memcpy(tail, data + i, rest);
+    tail[rest] = 0x80;
+    const size_t tail_size = rest + 9 <= 64 ? 64 : 128;
+    const uint64_t bits = (uint64_t)size * 8;
+    for (int k = 0; k < 8; k++)
+      tail[tail_size - 1 - k] = (unsigned char)(bits >> (8 * k));
+    for (size_t j = 0; j < tail_size; j += 64)
+      sha._block(tail + j);
+
+    nam::ModelCache::Digest digest;
+    for (int k = 0; k < 8; k++)
+      for (int b = 0; b < 4; b++)
+        digest[4 * k + b] = (uint8_t)(sha._state[k] >> (24 - 8 * b));
+    return digest;
+  };
+
+private:
+  uint32_t _state[8] = {0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19};
+
+  static uint32_t _rotate(const uint32_t x, const int n) { return (x >> n) | (x << (32 - n)); };
+
+  void _block(const unsigned char* block)
+  {
+    static constexpr uint32_t k[64] = {
+      0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5, 0xd807aa98,
+      0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174, 0xe49b69c1, 0xefbe4786,
+      0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da, 0x983e5152, 0xa831c66d, 0xb00327c8,
+      0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967, 0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
+      0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85, 0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819,
+      0xd6990624, 0xf40e3585, 0x106aa070, 0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a,
+      0x5b9cca4f, 0x682e6ff3, 0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7,
+      0xc67178f2};
+    uint32_t w[64];
+    for (int i = 0; i < 16; i++)
+      w[i] = ((uint32_t)block[4 * i] << 24) | ((uint32_t)block[4 * i + 1] << 16) | ((uint32_t)block[4 * i + 2] << 8)
+             | (uint32_t)block[4 * i + 3];
+    for (int i = 16; i < 64; i++)
+    {
+      const uint32_t s0 = _rotate(w[i - 15], 7) ^ _rotate(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      const uint32_t s1 = _rotate(w[i - 2], 17) ^ _rotate(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+    uint32_t a = this->_state[0], b = this->_state[1], c = this->_state[2], d = this->_state[3];
+    uint32_t e = this->_state[4], f = this->_state[5], g = this->_state[6], h = this->_state[7];
+    for (int i = 0; i < 64; i++)
+    {
+      const uint32_t t1 = h + (_rotate(e, 6) ^ _rotate(e, 11) ^ _rotate(e, 25)) + ((e & f) ^ (~e & g)) + k[i] + w[i];
+      const uint32_t t2 = (_rotate(a, 2) ^ _rotate(a, 13) ^ _rotate(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+      h = g;
+      g = f;
+      f = e;
+      e = d + t1;
+      d = c;
+      c = b;
+      b = a;
+      a = t1 + t2;
+    }
+    this->_state[0] += a;
+    this->_state[1] += b;
+    this->_state[2] += c;
+    this->_state[3] += d;
+    this->_state[4] += e;
+    this->_state[5] += f;
+    this->_state[6] += g;
+    this->_state[7] += h;
+  };
+};
+
+// Roughly how much memory a parsed model takes up.
+size_t get_bytes(const nam::dspData& data)
+{
+  return sizeof(nam::dspData) + data.weights.capacity() * sizeof(float) + data.version.size()
+         + data.architecture.size() + data.config.dump().size() + data.metadata.dump().size();
+}
+}; // namespace
+
+nam::ModelCache::ModelCache(const size_t budget_bytes)
+: _budget(budget_bytes)
+{
+}
+
+nam::ModelCache& nam::ModelCache::instance()
+{
+  static ModelCache cache;
+  return cache;
+}
+
+std::unique_ptr<nam::DSP> nam::ModelCache::get_dsp(const std::filesystem::path& filename)
+{
+  // Building a model only reads the parsed model, so it can come straight from the cache.
+  return nam::get_dsp(*this->get_data(filename));
+}
+
+std::shared_ptr<const nam::dspData> nam::ModelCache::get_data(const std::filesystem::path& filename)
+{
+  const std::string path_key = std::filesystem::absolute(filename).lexically_normal().string();
+  std::error_code ec;
+  const std::filesystem::file_time_type mtime = std::filesystem::last_write_time(filename, ec);
+  const uintmax_t file_size = ec ? 0 : std::filesystem::file_size(filename, ec);
+  if (ec)
+    throw std::runtime_error("Failed to read " + filename.string() + ": " + ec.message());
+
+  // Hit without touching the file?
+  {
+    std::lock_guard<std::mutex> lock(this->_mutex);
+    auto it = this->_paths.find(path_key);
+    if (it != this->_paths.end() && it->second.mtime == mtime && it->second.file_size == file_size)
+    {
+      std::shared_ptr<const dspData> data = this->_find(it->second.key);
+      if (data != nullptr)
+        return data;
+    }
+  }
+
+  // Either new or changed. The contents might still be something we've seen under another name.
+  util::MappedFile file(filename);
+  const ContentKey key = {Sha256::hash(file.data(), file.size()), file.size()};
+  {
+    std::lock_guard<std::mutex> lock(this->_mutex);
+    this->_paths[path_key] = {mtime, file_size, key};
+    std::shared_ptr<const dspData> data = this->_find(key);
+    if (data != nullptr)
+      return data;
+  }
+
+  // Parse without holding the lock so that other models can be served meanwhile.
+  auto data = std::make_shared<dspData>();
+  if (binary_model::is_binary_model(file.data(), file.size()))
+  {
+    std::span<const float> weights = binary_model::parse(file.data(), file.size(), *data);
+    data->weights.assign(weights.begin(), weights.end());
+  }
+  else
+    json_loader::parse(file.data(), file.size(), *data);
+  verify_config_version(data->version);
+
+  std::lock_guard<std::mutex> lock(this->_mutex);
+  return this->_insert(key, std::move(data));
+}
+
+size_t nam::ModelCache::get_budget() const
+{
+  std::lock_guard<std::mutex> lock(this->_mutex);
+  return this->_budget;
+}
+
+void nam::ModelCache::set_budget(const size_t budget_bytes)
+{
+  std::lock_guard<std::mutex> lock(this->_mutex);
+  this->_budget = budget_bytes;
+  this->_evict_to_budget();
+}
+
+size_t nam::ModelCache::get_size() const
+{
+  std::lock_guard<std::mutex> lock(this->_mutex);
+  return this->_size;
+}
+
+size_t nam::ModelCache::get_num_entries() const
+{
+  std::lock_guard<std::mutex> lock(this->_mutex);
+  return this->_lru.size();
+}
+
+void nam::ModelCache::clear()
+{
+  std::lock_guard<std::mutex> lock(this->_mutex);
+  this->_lru.clear();
+  this->_entries.clear();
+  this->_paths.clear();
+  this->_size = 0;
+}
+
+std::shared_ptr<const nam::dspData> nam::ModelCache::_find(const ContentKey& key)
+{
+  auto it = this->_entries.find(key);
+  if (it == this->_entries.end())
+    return nullptr;
+  this->_lru.splice(this->_lru.begin(), this->_lru, it->second);
+  return it->second->data;
+}
+
+std::shared_ptr<const nam::dspData> nam::ModelCache::_insert(const ContentKey& key,
+                                                             std::shared_ptr<const dspData> data)
+{
+  // Someone else may have parsed the same thing while we weren't holding the lock.
+  std::shared_ptr<const dspData> existing = this->_find(key);
+  if (existing != nullptr)
+    return existing;
+  const size_t bytes = get_bytes(*data);
+  this->_lru.push_front({key, data, bytes});
+  this->_entries[key] = this->_lru.begin();
+  this->_size += bytes;
+  this->_evict_to_budget();
+  return data;
+}
+
+void nam::ModelCache::_evict_to_budget()
+{
+  while (this->_size > this->_budget && !this->_lru.empty())
+  {
+    const Entry& victim = this->_lru.back();
+    for (auto it = this->_paths.begin(); it != this->_paths.end();)
+    {
+      if (it->second.key == victim.key)
+        it = this->_paths.erase(it);
+      else
+        ++it;
+    }
+    this->_entries.erase(victim.key);
+    this->_size -= victim.bytes;
+    this->_lru.pop_back();
+  }
+}
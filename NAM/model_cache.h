@@ -0,0 +1,98 @@
+#pragma once
+// Cache of parsed model files
+//
+// Services that instantiate the same models over and over can go through a ModelCache instead of get_dsp(). The first
+// request for a file parses it as usual; after that, as long as the file's modification time and size are unchanged,
+// new instances are built from the cached dspData without reading the file again. Entries are keyed by the SHA-256 of
+// the file contents, so identical files under different paths share one entry.
+//
+// The cache holds on to at most get_budget() bytes of parsed models and evicts the least recently used ones beyond
+// that. It is safe to use from several threads at once.
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include "dsp.h"
+
+namespace nam
+{
+class ModelCache
+{
+public:
+  ModelCache(const size_t budget_bytes = 256 * 1024 * 1024);
+
+  // A process-wide cache, for those who want one.
+  static ModelCache& instance();
+
+  // Like nam::get_dsp(), but the parsed model comes from the cache when possible.
+  std::unique_ptr<DSP> get_dsp(const std::filesystem::path& filename);
+  // The parsed model, loading it into the cache if needed.
+  // The returned data stays valid even if it is later evicted.
+  std::shared_ptr<const dspData> get_data(const std::filesystem::path& filename);
+
+  size_t get_budget() const;
+  // Evicts as needed to get under the new budget.
+  void set_budget(const size_t budget_bytes);
+  // Approximate number of bytes held by the cached models
+  size_t get_size() const;
+  size_t get_num_entries() const;
+  void clear();
+
+  // A SHA-256 of a file's contents
+  typedef std::array<uint8_t, 32> Digest;
+
+private:
+  struct ContentKey
+  {
+    Digest digest;
+    uint64_t size;
+    bool operator==(const ContentKey& other) const { return digest == other.digest && size == other.size; };
+  };
+  struct ContentKeyHash
+  {
+    // The digest is already well mixed, so any 8 bytes of it will do.
+    size_t operator()(const ContentKey& key) const
+    {
+      uint64_t hash;
+      std::memcpy(&hash, key.digest.data(), sizeof(hash));
+      return (size_t)hash;
+    };
+  };
+  struct Entry
+  {
+    ContentKey key;
+    std::shared_ptr<const dspData> data;
+    size_t bytes;
+  };
+  // What we last saw at a path
+  struct PathInfo
+  {
+    std::filesystem::file_time_type mtime;
+    uintmax_t file_size;
+    ContentKey key;
+  };
+
+  mutable std::mutex _mutex;
+  size_t _budget;
+  size_t _size = 0;
+  // Most recently used at the front
+  std::list<Entry> _lru;
+  std::unordered_map<ContentKey, std::list<Entry>::iterator, ContentKeyHash> _entries;
+  std::unordered_map<std::string, PathInfo> _paths;
+
+  // Look up a cached model and mark it as recently used. Call with the mutex held.
+  std::shared_ptr<const dspData> _find(const ContentKey& key);
+  // Add a freshly-parsed model. Call with the mutex held.
+  std::shared_ptr<const dspData> _insert(const ContentKey& key, std::shared_ptr<const dspData> data);
+  // Call with the mutex held.
+  void _evict_to_budget();
+};
+}; // namespace nam
@@ -0,0 +1,117 @@
+#include <stdexcept>
+
+#include "binary_model.h"
+#include "dsp.h"
+#include "json_loader.h"
+#include "model_info.h"
+#include "model_pack.h"
+#include "util.h"
+
+namespace
+{
+// Mirrors what the constructors read off of the weight array.
+void describe_architecture(nam::ModelInfo& info)
+{
+  const nlohmann::json& config = info.config;
+  size_t weights = 0;
+  long receptive_field = 0;
+  if (info.architecture == "Linear")
+  {
+    receptive_field = config.at("receptive_field");
+    weights = receptive_field + (config.at("bias").get<bool>() ? 1 : 0);
+  }
+  else if (info.architecture == "ConvNet")
+  {
+    const size_t channels = config.at("channels");
+    const bool batchnorm = config.at("batchnorm");
+    receptive_field = 1;
+    size_t in_channels = 1;
+    for (const auto& dilation : config.at("dilations"))
+    {
+      // Kernel size is always 2
+      weights += 2 * in_channels * channels + (batchnorm ? 4 * channels + 1 : channels);
+      receptive_field += dilation.get<long>();
+      in_channels = channels;
+    }
+    // Head
+    weights += channels + 1;
+  }
+  else if (info.architecture == "LSTM")
+  {
+    const size_t num_layers = config.at("num_layers");
+    const size_t input_size = config.at("input_size");
+    const size_t hidden_size = config.at("hidden_size");
+    for (size_t i = 0; i < num_layers; i++)
+    {
+      const size_t layer_input_size = i == 0 ? input_size : hidden_size;
+      // Gate weights and biases, then the initial hidden and cell states
+      weights += 4 * hidden_size * (layer_input_size + hidden_size) + 4 * hidden_size + 2 * hidden_size;
+    }
+    // Head
+    weights += hidden_size + 1;
+    receptive_field = 0;
+  }
+  else if (info.architecture == "WaveNet")
+  {
+    receptive_field = 1;
+    for (const auto& layer_config : config.at("layers"))
+    {
+      const size_t input_size = layer_config.at("input_size");
+      const size_t condition_size = layer_config.at("condition_size");
+      const size_t head_size = layer_config.at("head_size");
+      const size_t channels = layer_config.at("channels");
+      const size_t kernel_size = layer_config.at("kernel_size");
+      const bool gated = layer_config.at("gated");
+      const bool head_bias = layer_config.at("head_bias");
+      const size_t conv_out = gated ? 2 * channels : channels;
+      // Rechannel
+      weights += input_size * channels;
+      for (const auto& dilation : layer_config.at("dilations"))
+      {
+        // Dilated conv, input mixin and 1x1
+        weights += kernel_size * channels * conv_out + conv_out + condition_size * conv_out + channels * channels
+                   + channels;
+        receptive_field += (long)(kernel_size - 1) * dilation.get<long>();
+      }
+      // Head rechannel
+      weights += channels * head_size + (head_bias ? head_size : 0);
+    }
+    // Head scale
+    weights += 1;
+  }
+  else
+    throw std::runtime_error("Unrecognized architecture " + info.architecture);
+  info.expected_num_weights = weights;
+  info.receptive_field = receptive_field;
+}
+}; // namespace
+
+nam::ModelInfo nam::get_model_info(const std::filesystem::path& model_file)
+{
+  if (!std::filesystem::exists(model_file))
+    throw std::runtime_error("Model file doesn't exist!\n");
+  util::MappedFile file(model_file);
+  return get_model_info(std::as_bytes(std::span<const char>(file.data(), file.size())));
+}
+
+nam::ModelInfo nam::get_model_info(std::span<const std::byte> model_data)
+{
+  const char* data = reinterpret_cast<const char*>(model_data.data());
+  if (model_pack::is_model_pack(data, model_data.size()))
+    throw std::runtime_error("This is a model pack; its index already describes the models in it");
+  dspData conf;
+  ModelInfo info;
+  if (binary_model::is_binary_model(data, model_data.size()))
+    info.num_weights = binary_model::parse(data, model_data.size(), conf).size();
+  else
+    info.num_weights = json_loader::parse_header(data, model_data.size(), conf);
+  info.version = conf.version;
+  info.architecture = conf.architecture;
+  info.config = std::move(conf.config);
+  info.metadata = std::move(conf.metadata);
+  info.expected_sample_rate = conf.expected_sample_rate;
+  if (info.metadata.is_object() && info.metadata.contains("loudness") && info.metadata.at("loudness").is_number())
+    info.loudness = info.metadata.at("loudness").get<double>();
+  describe_architecture(info);
+  return info;
+}
@@ -0,0 +1,38 @@
+#pragma once
+// Inspecting models without loading them
+//
+// Model browsers and admission checks only need to know what a model is, not run it. get_model_info() reads
+// everything but the weights (which it only counts), and works out from the config how many weights the model should
+// have and how far back it looks, without building the network.
+
+#include <cstddef>
+#include <filesystem>
+#include <optional>
+#include <span>
+#include <string>
+
+#include "json.hpp"
+
+namespace nam
+{
+struct ModelInfo
+{
+  std::string version;
+  std::string architecture;
+  nlohmann::json config;
+  nlohmann::json metadata;
+  double expected_sample_rate;
+  std::optional<double> loudness;
+  // Weights in the file
+  size_t num_weights;
+  // Weights the architecture and config call for. A loadable model has num_weights == expected_num_weights.
+  size_t expected_num_weights;
+  // How many input samples each output sample depends on, or 0 if there's no limit (LSTMs), as for
+  // DSP::get_receptive_field().
+  long receptive_field;
+};
+
+// Either format of model file is accepted.
+ModelInfo get_model_info(const std::filesystem::path& model_file);
+ModelInfo get_model_info(std::span<const std::byte> model_data);
+}; // namespace nam
@@ -0,0 +1,184 @@
+#include <bit>
+#include <cstring>
+#include <sstream>
+#include <stdexcept>
+
+#include "binary_model.h"
+#include "json.hpp"
+#include "model_pack.h"
+
+namespace
+{
+void check_endianness()
+{
+  if constexpr (std::endian::native != std::endian::little)
+    throw std::runtime_error("Model packs are only supported on little-endian platforms");
+}
+}; // namespace
+
+bool nam::model_pack::is_model_pack(const char* data, const size_t size)
+{
+  return size >= sizeof(kMagic) && std::memcmp(data, kMagic, sizeof(kMagic)) == 0;
+}
+
+bool nam::model_pack::is_model_pack(const std::filesystem::path& filename)
+{
+  std::ifstream file(filename, std::ios::binary);
+  char magic[sizeof(kMagic)];
+  if (!file.read(magic, sizeof(magic)))
+    return false;
+  return is_model_pack(magic, sizeof(magic));
+}
+
+// ModelPack ==================================================================
+
+nam::model_pack::ModelPack::ModelPack(const std::filesystem::path& filename)
+: _file(filename)
+{
+  check_endianness();
+  const char* data = this->_file.data();
+  const size_t size = this->_file.size();
+  if (size < sizeof(Header) || !is_model_pack(data, size))
+    throw std::runtime_error(filename.string() + " is not a model pack");
+  Header header;
+  std::memcpy(&header, data, sizeof(Header));
+  if (header.format_version != kFormatVersion)
+  {
+    std::stringstream ss;
+    ss << "Model pack is format version " << header.format_version << ", but only version " << kFormatVersion
+       << " is supported. Rebuild it from the model files.";
+    throw std::runtime_error(ss.str());
+  }
+  if (header.index_offset == 0)
+    throw std::runtime_error("Model pack " + filename.string() + " was never finished");
+  if (header.index_offset > size || header.index_size > size - header.index_offset)
+    throw std::runtime_error("Corrupted model pack: index runs past the end of the file");
+
+  const char* index_begin = data + header.index_offset;
+  const nlohmann::json index = nlohmann::json::parse(index_begin, index_begin + header.index_size);
+  if (!index.is_array() || index.size() != header.num_models)
+    throw std::runtime_error("Corrupted model pack: index doesn't match the header");
+  this->_entries.reserve(index.size());
+  for (const auto& item : index)
+  {
+    Entry entry;
+    entry.name = item.at("name");
+    entry.architecture = item.at("architecture");
+    entry.sample_rate = item.at("sample_rate");
+    if (!item.at("loudness").is_null())
+      entry.loudness = item.at("loudness").get<double>();
+    entry.num_weights = item.at("num_weights");
+    entry.offset = item.at("offset");
+    entry.size = item.at("size");
+    if (entry.offset > size || entry.size > size - entry.offset)
+      throw std::runtime_error("Corrupted model pack: model " + entry.name + " runs past the end of the file");
+    this->_by_name[entry.name] = this->_entries.size();
+    this->_entries.push_back(std::move(entry));
+  }
+}
+
+const nam::model_pack::Entry* nam::model_pack::ModelPack::find(const std::string& name) const
+{
+  auto it = this->_by_name.find(name);
+  return it == this->_by_name.end() ? nullptr : &this->_entries[it->second];
+}
+
+std::unique_ptr<nam::DSP> nam::model_pack::ModelPack::get_dsp(const std::string& name) const
+{
+  return nam::get_dsp(this->get_model_data(name));
+}
+
+std::span<const std::byte> nam::model_pack::ModelPack::get_model_data(const std::string& name) const
+{
+  const Entry& entry = this->_get(name);
+  return std::as_bytes(std::span<const char>(this->_file.data() + entry.offset, entry.size));
+}
+
+const nam::model_pack::Entry& nam::model_pack::ModelPack::_get(const std::string& name) const
+{
+  const Entry* entry = this->find(name);
+  if (entry == nullptr)
+    throw std::runtime_error("No model named " + name + " in the pack");
+  return *entry;
+}
+
+// PackWriter =================================================================
+
+nam::model_pack::PackWriter::PackWriter(const std::filesystem::path& filename)
+: _filename(filename)
+, _out(filename, std::ios::binary | std::ios::trunc)
+{
+  check_endianness();
+  if (!this->_out)
+    throw std::runtime_error("Failed to open " + filename.string() + " for writing");
+  // Placeholder until finish() knows where the index goes
+  Header header = {};
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.format_version = kFormatVersion;
+  this->_out.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+}
+
+void nam::model_pack::PackWriter::add(const std::string& name, const dspData& model)
+{
+  if (this->_finished)
+    throw std::runtime_error("Can't add models to a finished pack");
+  if (this->_by_name.find(name) != this->_by_name.end())
+    throw std::runtime_error("Duplicate model name in pack: " + name);
+
+  this->_pad_to_alignment();
+  Entry entry;
+  entry.name = name;
+  entry.architecture = model.architecture;
+  entry.sample_rate = model.expected_sample_rate;
+  if (model.metadata.is_object() && model.metadata.contains("loudness") && model.metadata.at("loudness").is_number())
+    entry.loudness = model.metadata.at("loudness").get<double>();
+  entry.num_weights = model.weights.size();
+  entry.offset = (uint64_t)this->_out.tellp();
+  entry.size = binary_model::save(model, this->_out);
+  if (!this->_out)
+    throw std::runtime_error("Failed to write " + this->_filename.string());
+  this->_by_name[name] = this->_entries.size();
+  this->_entries.push_back(std::move(entry));
+}
+
+void nam::model_pack::PackWriter::finish()
+{
+  if (this->_finished)
+    return;
+  nlohmann::json index = nlohmann::json::array();
+  for (const Entry& entry : this->_entries)
+  {
+    nlohmann::json item;
+    item["name"] = entry.name;
+    item["architecture"] = entry.architecture;
+    item["sample_rate"] = entry.sample_rate;
+    item["loudness"] = entry.loudness.has_value() ? nlohmann::json(*entry.loudness) : nlohmann::json(nullptr);
+    item["num_weights"] = entry.num_weights;
+    item["offset"] = entry.offset;
+    item["size"] = entry.size;
+    index.push_back(std::move(item));
+  }
+  const std::string index_str = index.dump();
+
+  Header header = {};
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.format_version = kFormatVersion;
+  header.index_offset = (uint64_t)this->_out.tellp();
+  header.index_size = index_str.size();
+  header.num_models = this->_entries.size();
+  this->_out.write(index_str.data(), index_str.size());
+  this->_out.seekp(0);
+  this->_out.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+  this->_out.close();
+  if (!this->_out)
+    throw std::runtime_error("Failed to write " + this->_filename.string());
+  this->_finished = true;
+}
+
+void nam::model_pack::PackWriter::_pad_to_alignment()
+{
+  const uint64_t position = (uint64_t)this->_out.tellp();
+  const uint64_t padding = (kModelAlignment - position % kModelAlignment) % kModelAlignment;
+  const char zeros[kModelAlignment] = {};
+  this->_out.write(zeros, padding);
+}
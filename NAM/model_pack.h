@@ -0,0 +1,111 @@
+#pragma once
+// Model packs (".nampack")
+//
+// Many models in one file, with a header pointing to an index at the end of the file so that a library can be browsed
+// without reading the models themselves. Layout (all integers little-endian):
+//
+//   Header (see below)
+//   The models, each a complete binary model (see binary_model.h) starting at a multiple of kModelAlignment bytes
+//   JSON index: an array with, for each model, its "name", "architecture", "sample_rate", "loudness" (or null),
+//   "num_weights", and the "offset" and "size" of its binary model within the pack
+//
+// Packs are memory-mapped, so opening one only reads the header and the index, and loading a model only touches that
+// model's pages.
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "dsp.h"
+#include "util.h"
+
+namespace nam
+{
+namespace model_pack
+{
+constexpr char kMagic[4] = {'N', 'A', 'M', 'P'};
+// Bump this whenever the layout changes.
+constexpr uint32_t kFormatVersion = 1;
+// Alignment of each model, relative to the start of the file. Keeps the weights in the models aligned too.
+constexpr uint64_t kModelAlignment = 64;
+
+struct Header
+{
+  char magic[4];
+  uint32_t format_version;
+  // Where the index lives. Zero if the pack was never finished.
+  uint64_t index_offset;
+  uint64_t index_size;
+  uint64_t num_models;
+};
+static_assert(sizeof(Header) == 32, "Model pack header must not have padding");
+
+// What the index knows about a model
+struct Entry
+{
+  std::string name;
+  std::string architecture;
+  double sample_rate;
+  std::optional<double> loudness;
+  uint64_t num_weights;
+  // The model's binary model, relative to the start of the pack
+  uint64_t offset;
+  uint64_t size;
+};
+
+// Whether `data` starts with the model pack magic number.
+bool is_model_pack(const char* data, const size_t size);
+// Whether the file at `filename` starts with the model pack magic number.
+bool is_model_pack(const std::filesystem::path& filename);
+
+// Read-only view of a pack file.
+class ModelPack
+{
+public:
+  ModelPack(const std::filesystem::path& filename);
+
+  // In the order they were added
+  const std::vector<Entry>& get_entries() const { return this->_entries; };
+  // nullptr if there's no model by that name
+  const Entry* find(const std::string& name) const;
+  // Throws if there's no model by that name.
+  std::unique_ptr<DSP> get_dsp(const std::string& name) const;
+  // The model's binary model, straight out of the mapped file. Valid for as long as the pack is.
+  std::span<const std::byte> get_model_data(const std::string& name) const;
+
+private:
+  util::MappedFile _file;
+  std::vector<Entry> _entries;
+  std::unordered_map<std::string, size_t> _by_name;
+
+  const Entry& _get(const std::string& name) const;
+};
+
+// Writes a pack one model at a time, so that building a large library doesn't need every model in memory at once.
+class PackWriter
+{
+public:
+  PackWriter(const std::filesystem::path& filename);
+  // Names must be unique within the pack.
+  void add(const std::string& name, const dspData& model);
+  // Writes the index. The pack can't be opened until this has been called.
+  void finish();
+
+private:
+  std::filesystem::path _filename;
+  std::ofstream _out;
+  std::vector<Entry> _entries;
+  std::unordered_map<std::string, size_t> _by_name;
+  bool _finished = false;
+
+  void _pad_to_alignment();
+};
+}; // namespace model_pack
+}; // namespace nam
@@ -0,0 +1,113 @@
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <stdexcept>
+#include <vector>
+
+#include "parallel_render.h"
+#include "thread_pool.h"
+
+namespace
+{
+// Render `num_frames` frames of `input` into `output` in chunks of `chunk_frames`, on up to `num_threads` threads.
+// `first_model` renders the first chunk as it is. Every other chunk is rendered right after the `lead_in_frames` frames
+// of input before it, whose output is thrown away, by its thread's model, or by a new one for each chunk if
+// `fresh_models`.
+void render_chunks(const nam::ModelFactory& make_model, std::unique_ptr<nam::DSP> first_model, const float* input,
+                   float* output, const size_t num_frames, const size_t chunk_frames, const size_t lead_in_frames,
+                   const size_t num_threads, const bool fresh_models)
+{
+  const size_t num_chunks = (num_frames + chunk_frames - 1) / chunk_frames;
+  const size_t num_workers = std::min(num_threads, num_chunks);
+
+  // Copied now, in case the output is the same buffer and another chunk overwrites them first
+  std::vector<float> lead_in(num_chunks * lead_in_frames);
+  for (size_t chunk = 1; chunk < num_chunks; chunk++)
+  {
+    const size_t start = chunk * chunk_frames;
+    std::copy(input + start - lead_in_frames, input + start, lead_in.begin() + chunk * lead_in_frames);
+  }
+
+  std::atomic<size_t> next_chunk{1};
+  std::vector<std::exception_ptr> errors(num_workers);
+  {
+    nam::ThreadPool pool(num_workers);
+    for (size_t worker = 0; worker < num_workers; worker++)
+      pool.submit([&, worker]() {
+        try
+        {
+          std::unique_ptr<nam::DSP> model;
+          if (worker == 0)
+          {
+            model = std::move(first_model);
+            model->render(input, output, std::min(chunk_frames, num_frames));
+          }
+          std::vector<float> discarded(lead_in_frames);
+          for (size_t chunk; (chunk = next_chunk++) < num_chunks;)
+          {
+            if (model == nullptr || fresh_models)
+              model = make_model();
+            const size_t start = chunk * chunk_frames;
+            const size_t frames = std::min(chunk_frames, num_frames - start);
+            model->render(lead_in.data() + chunk * lead_in_frames, discarded.data(), lead_in_frames);
+            model->render(input + start, output + start, frames);
+          }
+        }
+        catch (...)
+        {
+          errors[worker] = std::current_exception();
+        }
+      });
+    pool.wait();
+  }
+  for (const std::exception_ptr& error : errors)
+    if (error)
+      std::rethrow_exception(error);
+}
+
+size_t resolve_num_threads(const size_t num_threads)
+{
+  return num_threads > 0 ? num_threads : nam::ThreadPool::default_num_threads();
+}
+}; // namespace
+
+void nam::render_parallel(const ModelFactory& make_model, const float* input, float* output, const size_t num_frames,
+                          const size_t num_threads)
+{
+  if (num_frames == 0)
+    return;
+  // One model now, to find out whether this can work before starting any threads. It's in the state the serial render
+  // would start from, so it renders the first chunk as it is.
+  std::unique_ptr<DSP> first_model = make_model();
+  const long receptive_field = first_model->get_receptive_field();
+  if (receptive_field <= 0)
+    throw std::runtime_error("Can't render a model in parallel unless its receptive field is limited");
+
+  // A chunk's first frame of output depends on the receptive field's worth of input up to it, so each chunk but the
+  // first is primed with at least the frames before that. Chunks and primings are whole render blocks, lined up with
+  // the serial render's, because a matrix product can round a frame differently depending on where in a block it is.
+  // (The first chunk isn't primed with zeros for the same reason: a prewarmed model has seen zeros, but prewarm() goes
+  // a frame at a time.)
+  const size_t block_size = (size_t)first_model->get_render_block_size();
+  const auto round_up = [block_size](const size_t frames) {
+    return (frames + block_size - 1) / block_size * block_size;
+  };
+  const size_t priming_frames = round_up((size_t)receptive_field - 1);
+  const size_t threads = resolve_num_threads(num_threads);
+  const size_t chunk_frames =
+    round_up(std::max((num_frames + kChunksPerThread * threads - 1) / (kChunksPerThread * threads),
+                      kMinChunkPrimings * priming_frames));
+  render_chunks(
+    make_model, std::move(first_model), input, output, num_frames, chunk_frames, priming_frames, threads, false);
+}
+
+void nam::render_parallel_with_warm_up(const ModelFactory& make_model, const float* input, float* output,
+                                       const size_t num_frames, const size_t warm_up_frames, const size_t num_threads)
+{
+  if (num_frames == 0)
+    return;
+  const size_t threads = resolve_num_threads(num_threads);
+  const size_t chunk_frames = std::max((num_frames + kChunksPerThread * threads - 1) / (kChunksPerThread * threads),
+                                       std::max(kMinChunkPrimings * warm_up_frames, (size_t)1));
+  render_chunks(make_model, make_model(), input, output, num_frames, chunk_frames, warm_up_frames, threads, true);
+}
@@ -0,0 +1,47 @@
+#pragma once
+// Rendering one long input on many cores
+//
+// render() carries the model's state from one block to the next, so it only ever uses one core. But WaveNet, ConvNet
+// and Linear models only remember a limited stretch of their input (DSP::get_receptive_field()): each frame of output
+// depends on that frame of input and the receptive field's worth before it, and nothing else. So a long input can be
+// cut into chunks and rendered on several copies of the model at once. A fresh copy renders the first chunk, and the
+// copy for each of the others is first primed with the input just before it. Priming replaces everything in the
+// model's state that the chunk's output depends on, so the chunks come out bit-identical to rendering the whole input
+// in one go.
+//
+// LSTMs remember everything they've heard, so that doesn't work for them. But what they remember fades, so a chunk
+// that starts from the trained initial state and is warmed up on some of the input before it comes out close to the
+// serial render, and closer the longer the warm-up. render_parallel_with_warm_up() does that; `benchmodel --parallel`
+// shows the error at the seams for a few warm-up lengths, to pick one from.
+
+#include <cstddef>
+#include <functional>
+#include <memory>
+
+#include "dsp.h"
+
+namespace nam
+{
+// Makes a fresh, prewarmed copy of the model to render with, e.g. [&] { return nam::get_dsp(model_file); }. Called
+// from several threads at once.
+using ModelFactory = std::function<std::unique_ptr<DSP>()>;
+
+constexpr size_t kMinChunkPrimings = 16;
+constexpr size_t kChunksPerThread = 4;
+
+// Render `num_frames` frames of `input` into `output` (which may be the same buffer) on `num_threads` threads (0
+// means one per hardware thread), with exactly the result of make_model()->render(input, output, num_frames).
+// make_model() is called once per thread. Chunks are primed with the receptive field rounded up to whole render
+// blocks. They're at least kMinChunkPrimings times that long, so that priming costs little, and otherwise about
+// kChunksPerThread per thread, so that threads that finish early can pick up more.
+// Throws std::runtime_error if the model's receptive field isn't limited (e.g. an LSTM), and rethrows whatever
+// make_model() throws.
+void render_parallel(const ModelFactory& make_model, const float* input, float* output, const size_t num_frames,
+                     const size_t num_threads = 0);
+// Render like render_parallel(), for any model, but approximately: each chunk but the first gets a new model from
+// make_model() (so it starts from the trained initial state), which is warmed up on the `warm_up_frames` frames of
+// input before the chunk, and the output of the warm-up is thrown away. The first chunk is exact. Chunks are at least
+// kMinChunkPrimings times the warm-up long. Rethrows whatever make_model() throws.
+void render_parallel_with_warm_up(const ModelFactory& make_model, const float* input, float* output,
+                                  const size_t num_frames, const size_t warm_up_frames, const size_t num_threads = 0);
+}; // namespace nam
@@ -0,0 +1,54 @@
+#include <cmath>
+
+#include "prune.h"
+
+nam::prune::Channels nam::prune::all(const long n)
+{
+  Channels channels(n);
+  for (long i = 0; i < n; i++)
+    channels[i] = i;
+  return channels;
+}
+
+nam::prune::Channels nam::prune::with_offset(const Channels& channels, const long offset)
+{
+  Channels result(channels);
+  for (const long c : channels)
+    result.push_back(c + offset);
+  return result;
+}
+
+bool nam::prune::row_is_negligible(const Eigen::Ref<const Eigen::MatrixXf>& weights, const long row,
+                                   const Channels& cols, const float tolerance)
+{
+  for (const long j : cols)
+    if (std::abs(weights(row, j)) > tolerance)
+      return false;
+  return true;
+}
+
+bool nam::prune::col_is_negligible(const Eigen::Ref<const Eigen::MatrixXf>& weights, const Channels& rows,
+                                   const long col, const float tolerance)
+{
+  for (const long i : rows)
+    if (std::abs(weights(i, col)) > tolerance)
+      return false;
+  return true;
+}
+
+float nam::prune::activate(activations::Activation* activation, const float x)
+{
+  float y = x;
+  activation->apply(&y, 1);
+  return y;
+}
+
+Eigen::MatrixXf nam::prune::select(const Eigen::Ref<const Eigen::MatrixXf>& matrix, const Channels& rows,
+                                   const Channels& cols)
+{
+  Eigen::MatrixXf result(rows.size(), cols.size());
+  for (size_t j = 0; j < cols.size(); j++)
+    for (size_t i = 0; i < rows.size(); i++)
+      result(i, j) = matrix(rows[i], cols[j]);
+  return result;
+}
@@ -0,0 +1,55 @@
+#pragma once
+// Dead-channel elimination
+//
+// Trained models sometimes have channels that contribute nothing: every weight that reads them is (close to) zero, or
+// every weight that writes them is and their activation at zero input is too. DSP::prune_channels() finds those with a
+// fixed-point search (dropping one channel can make others dead) and shrinks the convolutions, the buffers between
+// them and their state to just the channels that are left. The result is a smaller model that computes the same thing,
+// up to the weights that were treated as zero.
+//
+// Gated WaveNets only lose residual channels. Their gate activation covers a stretch of the layer's memory rather than
+// exactly the gate rows, so shrinking the layer would change what it computes, and a shut gate doesn't get its
+// channel dropped.
+//
+// Weights and activations with a magnitude of at most the given tolerance count as zero. A tolerance of 0 only drops
+// channels that are exactly dead.
+
+#include <string>
+#include <vector>
+
+#include <Eigen/Dense>
+
+#include "activations.h"
+
+namespace nam
+{
+// What DSP::prune_channels() did to one set of channels
+struct PrunedChannels
+{
+  // Which one, e.g. "layer_arrays[0] residual"
+  std::string name;
+  long before;
+  long after;
+};
+
+namespace prune
+{
+// The indices of the channels that are kept, in order
+typedef std::vector<long> Channels;
+
+// All of 0, ..., n - 1
+Channels all(const long n);
+// `channels`, then each of them plus `offset` (e.g. both halves of a gated convolution)
+Channels with_offset(const Channels& channels, const long offset);
+// Whether row `row` of `weights` is negligible in the columns `cols`
+bool row_is_negligible(const Eigen::Ref<const Eigen::MatrixXf>& weights, const long row, const Channels& cols,
+                       const float tolerance);
+// Whether column `col` of `weights` is negligible in the rows `rows`
+bool col_is_negligible(const Eigen::Ref<const Eigen::MatrixXf>& weights, const Channels& rows, const long col,
+                       const float tolerance);
+// What `activation` maps x to
+float activate(activations::Activation* activation, const float x);
+// The rows `rows` and columns `cols` of `matrix`
+Eigen::MatrixXf select(const Eigen::Ref<const Eigen::MatrixXf>& matrix, const Channels& rows, const Channels& cols);
+}; // namespace prune
+}; // namespace nam
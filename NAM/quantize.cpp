@@ -0,0 +1,342 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <limits>
+
+// Pick the widest integer multiply-add the build targets. x86-64 always has SSE2.
+#if defined(__AVX2__)
+  #define NAM_INT8_AVX2
+  #include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+  #define NAM_INT8_SSE2
+  #include <emmintrin.h>
+#elif defined(__ARM_NEON)
+  #define NAM_INT8_NEON
+  #include <arm_neon.h>
+#endif
+
+#include "quantize.h"
+
+namespace
+{
+constexpr long kRowBlock = nam::Int8Matrix::kRowBlock;
+static_assert(kRowBlock == 8 && nam::Int8Matrix::kColBlock == 2, "The kernels are written for 8x2 weight blocks");
+
+// Two consecutive int16s as one int32, for broadcasting a pair of inputs
+int32_t load_pair(const int16_t* x)
+{
+  int32_t pair;
+  std::memcpy(&pair, x, sizeof(pair));
+  return pair;
+}
+
+float max_abs(const float* input, const long n)
+{
+  long k = 0;
+  float result = 0.0f;
+#if defined(NAM_INT8_AVX2)
+  const __m256 sign = _mm256_set1_ps(-0.0f);
+  __m256 m = _mm256_setzero_ps();
+  for (; k + 8 <= n; k += 8)
+    m = _mm256_max_ps(m, _mm256_andnot_ps(sign, _mm256_loadu_ps(input + k)));
+  __m128 m4 = _mm_max_ps(_mm256_castps256_ps128(m), _mm256_extractf128_ps(m, 1));
+#elif defined(NAM_INT8_SSE2)
+  const __m128 sign = _mm_set1_ps(-0.0f);
+  __m128 m4 = _mm_setzero_ps();
+  for (; k + 4 <= n; k += 4)
+    m4 = _mm_max_ps(m4, _mm_andnot_ps(sign, _mm_loadu_ps(input + k)));
+#endif
+#if defined(NAM_INT8_AVX2) || defined(NAM_INT8_SSE2)
+  m4 = _mm_max_ps(m4, _mm_movehl_ps(m4, m4));
+  m4 = _mm_max_ss(m4, _mm_shuffle_ps(m4, m4, 1));
+  result = _mm_cvtss_f32(m4);
+#endif
+  for (; k < n; k++)
+    result = std::max(result, std::abs(input[k]));
+  return result;
+}
+
+// Round input * inv_scale to the nearest int16
+void quantize_column(const float* input, const long n, const float inv_scale, int16_t* output)
+{
+  long k = 0;
+#if defined(NAM_INT8_AVX2)
+  const __m256 s = _mm256_set1_ps(inv_scale);
+  for (; k + 8 <= n; k += 8)
+  {
+    const __m256i q = _mm256_cvtps_epi32(_mm256_mul_ps(_mm256_loadu_ps(input + k), s));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(output + k),
+                     _mm_packs_epi32(_mm256_castsi256_si128(q), _mm256_extracti128_si256(q, 1)));
+  }
+#elif defined(NAM_INT8_SSE2)
+  const __m128 s = _mm_set1_ps(inv_scale);
+  for (; k + 8 <= n; k += 8)
+  {
+    const __m128i lo = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(input + k), s));
+    const __m128i hi = _mm_cvtps_epi32(_mm_mul_ps(_mm_loadu_ps(input + k + 4), s));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(output + k), _mm_packs_epi32(lo, hi));
+  }
+#endif
+  for (; k < n; k++)
+    output[k] = (int16_t)std::lrint(input[k] * inv_scale);
+}
+
+// Dot products of one block of kRowBlock rows with four quantized input frames, each `n` long (a multiple of
+// kColBlock). `w` is laid out as described for Int8Matrix::_weights. out is (kRowBlock, 4), column-major.
+// Four frames at a time share the weight loads and keep more multiply-adds in flight. The accumulators are spelled out
+// so that they stay in registers without relying on the optimizer to unroll anything.
+void dot_block(const int8_t* w, const int16_t* const x[4], const long n, int32_t* out)
+{
+#if defined(NAM_INT8_AVX2)
+  // Each int32 lane gets one row's pair of weights times the same pair of inputs.
+  auto madd = [](const __m256i acc, const __m256i w, const int16_t* x) {
+    const __m256i xv = _mm256_set1_epi32(load_pair(x));
+  #if defined(__AVXVNNI__)
+    return _mm256_dpwssd_avx_epi32(acc, w, xv);
+  #elif defined(__AVX512VNNI__) && defined(__AVX512VL__)
+    return _mm256_dpwssd_epi32(acc, w, xv);
+  #else
+    return _mm256_add_epi32(acc, _mm256_madd_epi16(w, xv));
+  #endif
+  };
+  // Two sets of accumulators, for alternate pairs of inputs, hide the multiply-add latency.
+  __m256i acc0 = _mm256_setzero_si256(), acc1 = acc0, acc2 = acc0, acc3 = acc0;
+  __m256i acc4 = acc0, acc5 = acc0, acc6 = acc0, acc7 = acc0;
+  long k = 0;
+  for (; k + 4 <= n; k += 4, w += 4 * kRowBlock)
+  {
+    const __m256i wv = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(w)));
+    const __m256i wv2 = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(w + 2 * kRowBlock)));
+    acc0 = madd(acc0, wv, x[0] + k);
+    acc1 = madd(acc1, wv, x[1] + k);
+    acc2 = madd(acc2, wv, x[2] + k);
+    acc3 = madd(acc3, wv, x[3] + k);
+    acc4 = madd(acc4, wv2, x[0] + k + 2);
+    acc5 = madd(acc5, wv2, x[1] + k + 2);
+    acc6 = madd(acc6, wv2, x[2] + k + 2);
+    acc7 = madd(acc7, wv2, x[3] + k + 2);
+  }
+  if (k < n)
+  {
+    const __m256i wv = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(w)));
+    acc0 = madd(acc0, wv, x[0] + k);
+    acc1 = madd(acc1, wv, x[1] + k);
+    acc2 = madd(acc2, wv, x[2] + k);
+    acc3 = madd(acc3, wv, x[3] + k);
+  }
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(out), _mm256_add_epi32(acc0, acc4));
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + kRowBlock), _mm256_add_epi32(acc1, acc5));
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 2 * kRowBlock), _mm256_add_epi32(acc2, acc6));
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + 3 * kRowBlock), _mm256_add_epi32(acc3, acc7));
+#elif defined(NAM_INT8_SSE2)
+  // As for AVX2, with the block split over two registers: rows 0-3 and rows 4-7.
+  struct Acc
+  {
+    __m128i lo = _mm_setzero_si128(), hi = _mm_setzero_si128();
+    void madd(const __m128i w_lo, const __m128i w_hi, const int16_t* x)
+    {
+      const __m128i xv = _mm_set1_epi32(load_pair(x));
+      lo = _mm_add_epi32(lo, _mm_madd_epi16(w_lo, xv));
+      hi = _mm_add_epi32(hi, _mm_madd_epi16(w_hi, xv));
+    }
+    void store(int32_t* out) const
+    {
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out), lo);
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(out + 4), hi);
+    }
+  };
+  Acc acc0, acc1, acc2, acc3;
+  for (long k = 0; k < n; k += 2, w += 2 * kRowBlock)
+  {
+    // Sign-extend to int16 without SSE4.1
+    const __m128i wv = _mm_loadu_si128(reinterpret_cast<const __m128i*>(w));
+    const __m128i w_lo = _mm_srai_epi16(_mm_unpacklo_epi8(wv, wv), 8);
+    const __m128i w_hi = _mm_srai_epi16(_mm_unpackhi_epi8(wv, wv), 8);
+    acc0.madd(w_lo, w_hi, x[0] + k);
+    acc1.madd(w_lo, w_hi, x[1] + k);
+    acc2.madd(w_lo, w_hi, x[2] + k);
+    acc3.madd(w_lo, w_hi, x[3] + k);
+  }
+  acc0.store(out);
+  acc1.store(out + kRowBlock);
+  acc2.store(out + 2 * kRowBlock);
+  acc3.store(out + 3 * kRowBlock);
+#elif defined(NAM_INT8_NEON)
+  // Lanes hold half of a row's products each: (r, c), (r, c + 1), (r + 1, c), (r + 1, c + 1)
+  struct Acc
+  {
+    int32x4_t a[4] = {vdupq_n_s32(0), vdupq_n_s32(0), vdupq_n_s32(0), vdupq_n_s32(0)};
+    void mla(const int16x8_t w_lo, const int16x8_t w_hi, const int16_t* x)
+    {
+      const int16x4_t xv = vreinterpret_s16_s32(vdup_n_s32(load_pair(x)));
+      a[0] = vmlal_s16(a[0], vget_low_s16(w_lo), xv);
+      a[1] = vmlal_s16(a[1], vget_high_s16(w_lo), xv);
+      a[2] = vmlal_s16(a[2], vget_low_s16(w_hi), xv);
+      a[3] = vmlal_s16(a[3], vget_high_s16(w_hi), xv);
+    }
+    void store(int32_t* out) const
+    {
+      for (int i = 0; i < 4; i++)
+      {
+        out[2 * i] = vgetq_lane_s32(a[i], 0) + vgetq_lane_s32(a[i], 1);
+        out[2 * i + 1] = vgetq_lane_s32(a[i], 2) + vgetq_lane_s32(a[i], 3);
+      }
+    }
+  };
+  Acc acc0, acc1, acc2, acc3;
+  for (long k = 0; k < n; k += 2, w += 2 * kRowBlock)
+  {
+    const int16x8_t w_lo = vmovl_s8(vld1_s8(w));
+    const int16x8_t w_hi = vmovl_s8(vld1_s8(w + 8));
+    acc0.mla(w_lo, w_hi, x[0] + k);
+    acc1.mla(w_lo, w_hi, x[1] + k);
+    acc2.mla(w_lo, w_hi, x[2] + k);
+    acc3.mla(w_lo, w_hi, x[3] + k);
+  }
+  acc0.store(out);
+  acc1.store(out + kRowBlock);
+  acc2.store(out + 2 * kRowBlock);
+  acc3.store(out + 3 * kRowBlock);
+#else
+  for (long i = 0; i < 4 * kRowBlock; i++)
+    out[i] = 0;
+  for (long k = 0; k < n; k += 2, w += 2 * kRowBlock)
+    for (int f = 0; f < 4; f++)
+      for (long r = 0; r < kRowBlock; r++)
+        out[f * kRowBlock + r] += (int32_t)w[2 * r] * (int32_t)x[f][k] + (int32_t)w[2 * r + 1] * (int32_t)x[f][k + 1];
+#endif
+}
+
+// output (+)= dots * scales * input_scale, over `n` rows (kRowBlock for a full block)
+void scale_block(const int32_t* dots, const float* scales, const float input_scale, float* output, const long n,
+                 const bool accumulate)
+{
+#if defined(NAM_INT8_AVX2)
+  if (n == kRowBlock)
+  {
+    __m256 y = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(dots))),
+                             _mm256_mul_ps(_mm256_loadu_ps(scales), _mm256_set1_ps(input_scale)));
+    if (accumulate)
+      y = _mm256_add_ps(y, _mm256_loadu_ps(output));
+    _mm256_storeu_ps(output, y);
+    return;
+  }
+#elif defined(NAM_INT8_SSE2)
+  if (n == kRowBlock)
+  {
+    const __m128 s = _mm_set1_ps(input_scale);
+    for (int i = 0; i < kRowBlock; i += 4)
+    {
+      __m128 y = _mm_mul_ps(_mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(dots + i))),
+                            _mm_mul_ps(_mm_loadu_ps(scales + i), s));
+      if (accumulate)
+        y = _mm_add_ps(y, _mm_loadu_ps(output + i));
+      _mm_storeu_ps(output + i, y);
+    }
+    return;
+  }
+#endif
+  for (long i = 0; i < n; i++)
+  {
+    const float y = (float)dots[i] * scales[i] * input_scale;
+    output[i] = accumulate ? output[i] + y : y;
+  }
+}
+}; // namespace
+
+// Int16Activations ===========================================================
+
+void nam::Int16Activations::quantize_(const Eigen::Ref<const Eigen::MatrixXf>& input, const int32_t max_value)
+{
+  const long channels = input.rows();
+  const long padded_channels = (channels + Int8Matrix::kColBlock - 1) / Int8Matrix::kColBlock * Int8Matrix::kColBlock;
+  const long num_frames = input.cols();
+  const size_t needed = (size_t)(padded_channels * num_frames);
+  if (padded_channels != this->_padded_channels || this->_data.size() < needed)
+    this->_data.assign(std::max(needed, this->_data.size()), 0);
+  if ((long)this->_scales.size() < num_frames)
+    this->_scales.resize(num_frames);
+  this->_channels = channels;
+  this->_padded_channels = padded_channels;
+  this->_num_frames = num_frames;
+
+  for (long j = 0; j < num_frames; j++)
+  {
+    const float scale = max_abs(input.col(j).data(), channels) / (float)max_value;
+    this->_scales[j] = scale;
+    quantize_column(input.col(j).data(), channels, scale > 0.0f ? 1.0f / scale : 0.0f,
+                    this->_data.data() + j * padded_channels);
+  }
+}
+
+void nam::Int16Activations::reserve_(const long channels, const long num_frames)
+{
+  const long padded_channels = (channels + Int8Matrix::kColBlock - 1) / Int8Matrix::kColBlock * Int8Matrix::kColBlock;
+  const size_t needed = (size_t)(padded_channels * num_frames);
+  if (padded_channels != this->_padded_channels || this->_data.size() < needed)
+    this->_data.assign(std::max(needed, this->_data.size()), 0);
+  if ((long)this->_scales.size() < num_frames)
+    this->_scales.resize(num_frames);
+  this->_channels = channels;
+  this->_padded_channels = padded_channels;
+}
+
+// Int8Matrix =================================================================
+
+nam::Int8Matrix::Int8Matrix(const Eigen::Ref<const Eigen::MatrixXf>& weights)
+: _rows(weights.rows())
+, _cols(weights.cols())
+, _padded_rows((weights.rows() + kRowBlock - 1) / kRowBlock * kRowBlock)
+, _padded_cols((weights.cols() + kColBlock - 1) / kColBlock * kColBlock)
+{
+  this->_weights.assign(this->_padded_rows * this->_padded_cols, 0);
+  this->_scales.assign(this->_padded_rows, 0.0f);
+  for (long i = 0; i < this->_rows; i++)
+  {
+    const float max_abs = this->_cols > 0 ? weights.row(i).cwiseAbs().maxCoeff() : 0.0f;
+    const float scale = max_abs / 127.0f;
+    this->_scales[i] = scale;
+    if (scale == 0.0f)
+      continue;
+    int8_t* block = this->_weights.data() + (i / kRowBlock) * kRowBlock * this->_padded_cols;
+    const long r = i % kRowBlock;
+    for (long j = 0; j < this->_cols; j++)
+      block[(j / kColBlock) * kRowBlock * kColBlock + r * kColBlock + j % kColBlock] =
+        (int8_t)std::lrint(weights(i, j) / scale);
+  }
+}
+
+int32_t nam::Int8Matrix::get_input_max() const
+{
+  // |w| <= 127 and |x| <= this, summed over _padded_cols products, has to fit in an int32.
+  const int64_t limit = std::numeric_limits<int32_t>::max() / (127 * std::max(this->_padded_cols, 1L));
+  return (int32_t)std::min<int64_t>(limit, std::numeric_limits<int16_t>::max());
+}
+
+void nam::Int8Matrix::multiply_(const Int16Activations& input, const long i_start, Eigen::Ref<Eigen::MatrixXf> output,
+                                const bool accumulate) const
+{
+  const long num_frames = output.cols();
+  const long stride = input._padded_channels;
+  const int16_t* x = input._data.data() + i_start * stride;
+  int32_t dots[4 * kRowBlock];
+
+  for (long b = 0; b < this->_padded_rows; b += kRowBlock)
+  {
+    const int8_t* w = this->_weights.data() + b * this->_padded_cols;
+    const long block_rows = std::min(kRowBlock, this->_rows - b);
+    for (long j = 0; j < num_frames; j += 4)
+    {
+      // Past the end, repeat the last frame and throw away the result.
+      const int n = (int)std::min(4L, num_frames - j);
+      const int16_t* frames[4];
+      for (int f = 0; f < 4; f++)
+        frames[f] = x + (j + std::min(f, n - 1)) * stride;
+      dot_block(w, frames, this->_padded_cols, dots);
+      // Back to float
+      for (int f = 0; f < n; f++)
+        scale_block(dots + f * kRowBlock, this->_scales.data() + b, input._scales[i_start + j + f], &output(b, j + f),
+                    block_rows, accumulate);
+    }
+  }
+}
@@ -0,0 +1,77 @@
+#pragma once
+// Int8 inference for the convolutions
+//
+// Int8Matrix holds a weight matrix as int8 with one scale per output channel (row), worked out when the model is
+// quantized. Inputs are quantized to int16 with one scale per frame (column) by Int16Activations, products are
+// accumulated in int32, and the result is scaled back to float. Compared to the float path, that reads a quarter of the
+// weight bytes and does twice the multiply-adds per instruction, at the cost of a small amount of error (see
+// `benchmodel --int8`).
+//
+// The dot products use AVX-VNNI/AVX512-VNNI or AVX2 on x86 when the build targets them (see the NAM_ENABLE_* options
+// in CMakeLists.txt) and SSE2 when it doesn't, NEON on ARM, and plain C++ otherwise.
+
+#include <cstdint>
+#include <vector>
+
+#include <Eigen/Dense>
+
+namespace nam
+{
+// A block of input frames quantized for Int8Matrix::multiply_(). Quantize once and share it between every matrix that
+// reads the same input (e.g. the taps of a convolution).
+class Int16Activations
+{
+public:
+  // :param input: (channels, num_frames)
+  // :param max_value: What the largest magnitude in each frame maps to. See Int8Matrix::get_input_max().
+  void quantize_(const Eigen::Ref<const Eigen::MatrixXf>& input, const int32_t max_value);
+  // Make room to quantize up to `num_frames` frames of `channels` channels without allocating
+  void reserve_(const long channels, const long num_frames);
+  long get_channels() const { return this->_channels; };
+  long get_num_frames() const { return this->_num_frames; };
+
+private:
+  friend class Int8Matrix;
+  long _channels = 0;
+  long _padded_channels = 0;
+  long _num_frames = 0;
+  // Column-major (_padded_channels, _num_frames). Grows to fit; the padding is zeros.
+  std::vector<int16_t> _data;
+  // Per frame
+  std::vector<float> _scales;
+};
+
+class Int8Matrix
+{
+public:
+  // Output channels are handled this many at a time (one int32 per lane of a 256-bit register)...
+  static constexpr long kRowBlock = 8;
+  // ...and input channels in pairs (one int16 multiply-add per pair). Both are zero-padded to fit.
+  static constexpr long kColBlock = 2;
+
+  Int8Matrix() = default;
+  // Quantize `weights` (out_channels, in_channels)
+  Int8Matrix(const Eigen::Ref<const Eigen::MatrixXf>& weights);
+
+  long rows() const { return this->_rows; };
+  long cols() const { return this->_cols; };
+  // Whether there's a matrix here at all (default-constructed ones stand for "use the float weights")
+  bool empty() const { return this->_rows == 0; };
+  // Largest magnitude to quantize inputs to so that no dot product overflows int32
+  int32_t get_input_max() const;
+  // output = weights * input[:, i_start:i_start + output.cols()], or += that if `accumulate`.
+  void multiply_(const Int16Activations& input, const long i_start, Eigen::Ref<Eigen::MatrixXf> output,
+                 const bool accumulate) const;
+
+private:
+  long _rows = 0;
+  long _cols = 0;
+  long _padded_rows = 0;
+  long _padded_cols = 0;
+  // Blocks of kRowBlock rows, one after the other. Within a block, the weights for each pair of input channels are
+  // together, row by row: w(r, c), w(r, c + 1), w(r + 1, c), w(r + 1, c + 1), ...
+  std::vector<int8_t> _weights;
+  // Per row, padded to _padded_rows
+  std::vector<float> _scales;
+};
+}; // namespace nam
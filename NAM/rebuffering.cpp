@@ -0,0 +1,91 @@
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+#include "rebuffering.h"
+
+nam::RebufferingDSP::RebufferingDSP(std::unique_ptr<DSP> model, const int block_size)
+: DSP(model->GetExpectedSampleRate())
+, _model(std::move(model))
+, _block_size(block_size)
+{
+  if (block_size <= 0)
+    throw std::runtime_error("Block size must be positive");
+  if (this->_model->HasLoudness())
+    this->SetLoudness(this->_model->GetLoudness());
+  // The model only ever sees whole blocks, whatever the host does.
+  this->_model->prepare(block_size);
+  this->_input_block.assign(block_size, 0.0f);
+  this->_output_block.assign(block_size, 0.0f);
+}
+
+void nam::RebufferingDSP::process(const float* input, float* output, const int num_frames)
+{
+  this->_process(input, output, num_frames);
+}
+
+void nam::RebufferingDSP::process(const double* input, double* output, const int num_frames)
+{
+  this->_process(input, output, num_frames);
+}
+
+void nam::RebufferingDSP::finalize_(const int num_frames)
+{
+  this->DSP::finalize_(num_frames);
+}
+
+template <typename Sample>
+void nam::RebufferingDSP::_process(const Sample* input, Sample* output, const int num_frames)
+{
+  for (int start = 0; start < num_frames;)
+  {
+    const int n = std::min(this->_block_size - this->_position, num_frames - start);
+    // Take the input before writing the output, in case the host gave us one buffer for both.
+    for (int i = 0; i < n; i++)
+      this->_input_block[this->_position + i] = (float)input[start + i];
+    for (int i = 0; i < n; i++)
+      output[start + i] = (Sample)this->_output_block[this->_position + i];
+    this->_position += n;
+    start += n;
+    if (this->_position == this->_block_size)
+    {
+      this->_model->process(this->_input_block.data(), this->_output_block.data(), this->_block_size);
+      this->_model->finalize_(this->_block_size);
+      this->_position = 0;
+    }
+  }
+}
+
+int nam::RebufferingDSP::choose_block_size(DSP& model, const int max_block_size, const double tolerance)
+{
+  const int num_frames = 16384;
+  // Separate buffers, so the model only ever hears silence rather than its own output
+  const std::vector<float> silence(std::max(max_block_size, 16), 0.0f);
+  std::vector<float> output(silence.size());
+  std::vector<int> block_sizes;
+  std::vector<double> seconds_per_frame;
+  for (int block_size = 16; block_size <= std::max(max_block_size, 16); block_size *= 2)
+  {
+    double best = 1.0e30;
+    // Once to warm up (and let the model size its buffers), then the best of three
+    for (int trial = 0; trial < 4; trial++)
+    {
+      const auto start = std::chrono::steady_clock::now();
+      for (int frames = 0; frames < num_frames; frames += block_size)
+      {
+        model.process(silence.data(), output.data(), block_size);
+        model.finalize_(block_size);
+      }
+      const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+      if (trial > 0)
+        best = std::min(best, elapsed.count());
+    }
+    block_sizes.push_back(block_size);
+    seconds_per_frame.push_back(best / num_frames);
+  }
+  const double fastest = *std::min_element(seconds_per_frame.begin(), seconds_per_frame.end());
+  for (size_t i = 0; i < block_sizes.size(); i++)
+    if (seconds_per_frame[i] <= (1.0 + tolerance) * fastest)
+      return block_sizes[i];
+  return block_sizes.back();
+}
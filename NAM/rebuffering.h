@@ -0,0 +1,46 @@
+#pragma once
+// Fixed-size blocks for hosts that call with small or irregular ones
+//
+// Models get more done per frame with bigger blocks (bigger matrix products, less per-call overhead), and WaveNet and
+// ConvNet resize their buffers whenever the block size changes. RebufferingDSP collects host input into blocks of one
+// fixed size and only ever calls the model with whole blocks, at the cost of exactly one block of latency.
+
+#include <memory>
+#include <vector>
+
+#include "dsp.h"
+
+namespace nam
+{
+class RebufferingDSP : public DSP
+{
+public:
+  // Wrap `model`, which should already be prewarmed, to process `block_size` frames at a time
+  RebufferingDSP(std::unique_ptr<DSP> model, const int block_size);
+
+  void process(const float* input, float* output, const int num_frames) override;
+  void process(const double* input, double* output, const int num_frames) override;
+  void finalize_(const int num_frames) override;
+  // How far the output lags behind the input, in samples, on top of whatever latency the model has. Always the block
+  // size.
+  int get_latency() const { return this->_block_size; };
+  int get_block_size() const { return this->_block_size; };
+  DSP& get_model() { return *this->_model; };
+
+  // Time `model` on silence at block sizes of 16, 32, ... up to `max_block_size` and return the smallest one that's
+  // within `tolerance` (e.g. 0.1 for 10%) of the fastest per frame. This runs audio through the model, so call it
+  // before using the model, not while it's playing.
+  static int choose_block_size(DSP& model, const int max_block_size = 256, const double tolerance = 0.1);
+
+private:
+  std::unique_ptr<DSP> _model;
+  int _block_size;
+  // The block being collected, and the model's output for the last one, which is handed out as the next one comes in
+  std::vector<float> _input_block;
+  std::vector<float> _output_block;
+  int _position = 0;
+
+  template <typename Sample>
+  void _process(const Sample* input, Sample* output, const int num_frames);
+};
+}; // namespace nam
@@ -0,0 +1,160 @@
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+#include "render_engine.h"
+#include "thread_pool.h"
+
+namespace
+{
+// How many times to check for a new tick (or for the last models of one to finish) before going to sleep. Ticks are
+// milliseconds apart, so workers sleep between them, but the end of a tick is usually only microseconds away.
+constexpr int kSpinCount = 1000;
+// How much of each new timing goes into a model's cost
+constexpr double kCostSmoothing = 0.1;
+// The range word is the tick in the top 32 bits, then the front and back of the range in 16 bits each.
+constexpr uint64_t kMaxModels = 0xffff;
+
+uint64_t pack_range(const uint32_t tick, const uint64_t front, const uint64_t back)
+{
+  return ((uint64_t)tick << 32) | (front << 16) | back;
+}
+}; // namespace
+
+nam::RenderEngine::RenderEngine(const size_t num_threads)
+: _queues(num_threads > 0 ? num_threads : ThreadPool::default_num_threads())
+{
+  this->_threads.reserve(this->_queues.size() - 1);
+  for (size_t i = 1; i < this->_queues.size(); i++)
+    this->_threads.emplace_back(&RenderEngine::_worker, this, i);
+}
+
+nam::RenderEngine::~RenderEngine()
+{
+  this->_stop.store(true, std::memory_order_relaxed);
+  this->_tick.fetch_add(1, std::memory_order_release);
+  this->_tick.notify_all();
+  for (auto& thread : this->_threads)
+    thread.join();
+}
+
+size_t nam::RenderEngine::add(std::unique_ptr<DSP> model)
+{
+  if (this->_models.size() >= kMaxModels)
+    throw std::runtime_error("Too many models in one RenderEngine");
+  this->_models.push_back(std::move(model));
+  this->_costs.push_back(0.0);
+  this->_order.push_back((int)this->_order.size());
+  // So that dealing never allocates
+  for (Queue& queue : this->_queues)
+    queue.models.reserve(this->_models.size());
+  return this->_models.size() - 1;
+}
+
+void nam::RenderEngine::prepare(const int max_block_size)
+{
+  for (auto& model : this->_models)
+    model->prepare(max_block_size);
+}
+
+void nam::RenderEngine::process(const float* const* inputs, float* const* outputs, const int num_frames)
+{
+  if (this->_models.empty())
+    return;
+  this->_inputs = inputs;
+  this->_outputs = outputs;
+  this->_num_frames = num_frames;
+
+  // Deal the models out, heaviest first, each to the thread with the least so far
+  std::sort(this->_order.begin(), this->_order.end(),
+            [this](const int a, const int b) { return this->_costs[a] > this->_costs[b]; });
+  for (Queue& queue : this->_queues)
+  {
+    queue.models.clear();
+    queue.load = 0.0;
+  }
+  for (const int model : this->_order)
+  {
+    Queue& queue = *std::min_element(this->_queues.begin(), this->_queues.end(),
+                                     [](const Queue& a, const Queue& b) { return a.load < b.load; });
+    queue.models.push_back(model);
+    // Unmeasured models all count the same
+    queue.load += std::max(this->_costs[model], 1.0e-12);
+  }
+
+  const uint32_t tick = this->_tick.load(std::memory_order_relaxed) + 1;
+  this->_remaining.store((int)this->_models.size(), std::memory_order_relaxed);
+  for (Queue& queue : this->_queues)
+    queue.range.store(pack_range(tick, 0, queue.models.size()), std::memory_order_relaxed);
+  // Publishes all of the above to the workers
+  this->_tick.store(tick, std::memory_order_release);
+  this->_tick.notify_all();
+
+  this->_work(0, tick);
+  int remaining;
+  for (int i = 0; (remaining = this->_remaining.load(std::memory_order_acquire)) != 0; i++)
+    if (i < kSpinCount)
+      std::this_thread::yield();
+    else
+      this->_remaining.wait(remaining, std::memory_order_acquire);
+}
+
+void nam::RenderEngine::_worker(const size_t thread)
+{
+  uint32_t seen = 0;
+  while (true)
+  {
+    uint32_t tick;
+    for (int i = 0; (tick = this->_tick.load(std::memory_order_acquire)) == seen; i++)
+      if (i < kSpinCount)
+        std::this_thread::yield();
+      else
+        this->_tick.wait(seen, std::memory_order_acquire);
+    if (this->_stop.load(std::memory_order_relaxed))
+      return;
+    seen = tick;
+    this->_work(thread, tick);
+  }
+}
+
+void nam::RenderEngine::_work(const size_t thread, const uint32_t tick)
+{
+  const size_t num_queues = this->_queues.size();
+  while (true)
+  {
+    int model = this->_pop(this->_queues[thread], tick, false);
+    for (size_t i = 1; model < 0 && i < num_queues; i++)
+      model = this->_pop(this->_queues[(thread + i) % num_queues], tick, true);
+    if (model < 0)
+      return;
+    this->_run(model);
+    if (this->_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+      this->_remaining.notify_all();
+  }
+}
+
+int nam::RenderEngine::_pop(Queue& queue, const uint32_t tick, const bool back)
+{
+  uint64_t range = queue.range.load(std::memory_order_acquire);
+  while (true)
+  {
+    const uint64_t front_index = (range >> 16) & kMaxModels;
+    const uint64_t back_index = range & kMaxModels;
+    if ((uint32_t)(range >> 32) != tick || front_index >= back_index)
+      return -1;
+    const uint64_t claimed = back ? range - 1 : range + ((uint64_t)1 << 16);
+    if (queue.range.compare_exchange_weak(range, claimed, std::memory_order_acq_rel, std::memory_order_acquire))
+      return queue.models[back ? back_index - 1 : front_index];
+  }
+}
+
+void nam::RenderEngine::_run(const int model)
+{
+  const auto start = std::chrono::steady_clock::now();
+  this->_models[model]->process(this->_inputs[model], this->_outputs[model], this->_num_frames);
+  this->_models[model]->finalize_(this->_num_frames);
+  const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  const double cost = elapsed.count() / std::max(this->_num_frames, 1);
+  double& smoothed = this->_costs[model];
+  smoothed = smoothed == 0.0 ? cost : smoothed + kCostSmoothing * (cost - smoothed);
+}
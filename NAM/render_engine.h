@@ -0,0 +1,84 @@
+#pragma once
+// Running many models at once, every audio tick, on all cores
+//
+// A host with several models to run per block (one per track, per voice, per amp in a rig, ...) can hand them all to
+// a RenderEngine, which processes one block of each on a set of worker threads and returns once every model has
+// finished. Each model is run by one thread at a time, so a model's state never needs locking.
+//
+// Balancing: the engine times every model as it runs, and at the start of each tick deals them out to the threads
+// heaviest first, each to the thread with the least estimated work so far. Estimates go stale (a model's cost depends
+// on the block size, and other processes share the cores), so a thread that runs out of models steals from the end of
+// another thread's list, where the lightest ones are. The calling thread works too, and nothing here locks or
+// allocates once the engine is prepared.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include "dsp.h"
+
+namespace nam
+{
+class RenderEngine
+{
+public:
+  // 0 threads means one per hardware thread. The thread that calls process() is one of them, so this starts one
+  // fewer.
+  RenderEngine(const size_t num_threads = 0);
+  ~RenderEngine();
+  RenderEngine(const RenderEngine&) = delete;
+  RenderEngine& operator=(const RenderEngine&) = delete;
+
+  // Add a model, which should already be prewarmed, and return its index. Not while process() is running.
+  size_t add(std::unique_ptr<DSP> model);
+  size_t get_num_models() const { return this->_models.size(); };
+  DSP& get_model(const size_t index) { return *this->_models[index]; };
+  size_t get_num_threads() const { return this->_queues.size(); };
+
+  // Prepare every model for blocks of up to `max_block_size` frames. Not while process() is running.
+  void prepare(const int max_block_size);
+  // Process and finalize `num_frames` frames of every model, from inputs[i] to outputs[i] for model i, and return
+  // when they're all done. Each model's input and output may be the same buffer.
+  void process(const float* const* inputs, float* const* outputs, const int num_frames);
+  // The measured cost of a model, in seconds per frame (smoothed over recent ticks)
+  double get_cost(const size_t index) const { return this->_costs[index]; };
+
+private:
+  // One thread's models for the current tick. The range of them left to take is packed into one word with the tick
+  // it's for, so the owner (from the front) and thieves (from the back) claim models with a single compare-and-swap,
+  // and a thread that's still looking at an old tick can't claim anything from a new one.
+  struct alignas(64) Queue
+  {
+    std::atomic<uint64_t> range{0};
+    std::vector<int> models;
+    // Estimated seconds of work dealt to this thread, while dealing
+    double load = 0.0;
+  };
+
+  std::vector<std::unique_ptr<DSP>> _models;
+  std::vector<double> _costs;
+  // Model indices, sorted by cost each tick
+  std::vector<int> _order;
+  std::vector<Queue> _queues;
+  std::vector<std::thread> _threads;
+
+  // This tick
+  const float* const* _inputs = nullptr;
+  float* const* _outputs = nullptr;
+  int _num_frames = 0;
+  std::atomic<uint32_t> _tick{0};
+  // Models not finished yet
+  std::atomic<int> _remaining{0};
+  std::atomic<bool> _stop{false};
+
+  void _worker(const size_t thread);
+  // Run models until there are none left to claim for `tick`
+  void _work(const size_t thread, const uint32_t tick);
+  // Claim a model from the front (own) or the back (stolen) of a queue; -1 if it's empty
+  int _pop(Queue& queue, const uint32_t tick, const bool back);
+  void _run(const int model);
+};
+}; // namespace nam
@@ -0,0 +1,217 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <numbers>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+
+#include <Eigen/Dense>
+
+#include "resampling.h"
+
+namespace
+{
+// Zero crossings of the sinc on each side, at the lower of the two rates. More makes a steeper filter and costs
+// proportionally more.
+constexpr int kZeroCrossings = 24;
+// The sinc's cutoff (where it's 6dB down), as a fraction of the lower rate's Nyquist frequency. It's the middle of the
+// transition band, not the edge of the passband: with these zero crossings and this window, the response is flat to
+// about 0.8 and reaches the full stopband attenuation a little above 1.0.
+constexpr double kCutoff = 0.92;
+// Kaiser window shape; about 80dB of stopband.
+constexpr double kKaiserBeta = 8.0;
+
+// Modified Bessel function of the first kind, order 0 (std::cyl_bessel_i isn't everywhere)
+double bessel_i0(const double x)
+{
+  double sum = 1.0;
+  double term = 1.0;
+  for (int k = 1; k < 50; k++)
+  {
+    const double f = x / (2.0 * k);
+    term *= f * f;
+    sum += term;
+    if (term < 1.0e-12 * sum)
+      break;
+  }
+  return sum;
+}
+}; // namespace
+
+nam::PolyphaseResampler::PolyphaseResampler(const int up, const int down, const int max_input_frames)
+: _up(up)
+, _down(down)
+{
+  const int length = 2 * kZeroCrossings * std::max(up, down);
+  this->_taps = (length + up - 1) / up;
+  // The prototype lowpass, at up times the input rate
+  const long prototype_length = (long)this->_taps * up;
+  const double center = 0.5 * (prototype_length - 1);
+  const double cutoff = kCutoff * 0.5 / std::max(up, down); // Cycles per sample
+  const double window_norm = bessel_i0(kKaiserBeta);
+  std::vector<double> prototype(prototype_length);
+  double sum = 0.0;
+  for (long k = 0; k < prototype_length; k++)
+  {
+    const double t = k - center;
+    const double x = 2.0 * cutoff * t;
+    const double sinc = x == 0.0 ? 1.0 : std::sin(std::numbers::pi * x) / (std::numbers::pi * x);
+    const double r = t / (center + 1.0);
+    const double window = bessel_i0(kKaiserBeta * std::sqrt(std::max(0.0, 1.0 - r * r))) / window_norm;
+    prototype[k] = 2.0 * cutoff * sinc * window;
+    sum += prototype[k];
+  }
+  // Unity gain at DC after zero-stuffing by `up`
+  const double gain = up / sum;
+
+  this->_coefficients.resize(prototype_length);
+  for (int p = 0; p < up; p++)
+    for (int j = 0; j < this->_taps; j++)
+      this->_coefficients[(long)p * this->_taps + (this->_taps - 1 - j)] = (float)(gain * prototype[p + (long)j * up]);
+
+  this->_history.assign(this->_taps - 1 + max_input_frames, 0.0f);
+  this->_history_size = this->_taps - 1;
+  this->_index = this->_taps - 1;
+}
+
+int nam::PolyphaseResampler::process(const float* input, const int num_frames, float* output)
+{
+  std::copy(input, input + num_frames, this->_history.begin() + this->_history_size);
+  this->_history_size += num_frames;
+
+  const int taps = this->_taps;
+  int produced = 0;
+  while (this->_index < this->_history_size)
+  {
+    const Eigen::Map<const Eigen::VectorXf> coefficients(this->_coefficients.data() + (long)this->_phase * taps, taps);
+    const Eigen::Map<const Eigen::VectorXf> window(this->_history.data() + this->_index - taps + 1, taps);
+    output[produced++] = coefficients.dot(window);
+    this->_phase += this->_down;
+    this->_index += this->_phase / this->_up;
+    this->_phase %= this->_up;
+  }
+
+  // Keep just what the next output needs
+  const long drop = std::min(this->_index - (taps - 1), this->_history_size);
+  if (drop > 0)
+  {
+    std::memmove(this->_history.data(), this->_history.data() + drop, (this->_history_size - drop) * sizeof(float));
+    this->_history_size -= drop;
+    this->_index -= drop;
+  }
+  return produced;
+}
+
+int nam::PolyphaseResampler::get_max_output_frames(const int num_frames) const
+{
+  return (int)(((long)num_frames * this->_up + this->_down - 1) / this->_down) + 1;
+}
+
+double nam::PolyphaseResampler::get_latency() const
+{
+  return 0.5 * ((double)this->_taps * this->_up - 1.0) / this->_up;
+}
+
+nam::ResamplingDSP::ResamplingDSP(std::unique_ptr<DSP> model, const double host_sample_rate)
+: DSP(host_sample_rate)
+, _model(std::move(model))
+{
+  if (this->_model->HasLoudness())
+    this->SetLoudness(this->_model->GetLoudness());
+
+  const double model_sample_rate = this->_model->GetExpectedSampleRate();
+  const long host_rate = std::lround(host_sample_rate);
+  const long model_rate = std::lround(model_sample_rate);
+  if (model_sample_rate <= 0.0 || host_rate <= 0 || model_rate == host_rate)
+    return;
+
+  const long divisor = std::gcd(host_rate, model_rate);
+  const long up = model_rate / divisor;
+  const long down = host_rate / divisor;
+  if (up > kMaxRatioTerm || down > kMaxRatioTerm)
+    throw std::runtime_error("Can't resample between " + std::to_string(host_rate) + "Hz and "
+                             + std::to_string(model_rate) + "Hz (the ratio " + std::to_string(up) + "/"
+                             + std::to_string(down) + " is too fine)");
+
+  this->_to_model = std::make_unique<PolyphaseResampler>((int)up, (int)down, kChunkSize);
+  const int max_model_frames = this->_to_model->get_max_output_frames(kChunkSize);
+  this->_to_host = std::make_unique<PolyphaseResampler>((int)down, (int)up, max_model_frames);
+  const int max_host_frames = this->_to_host->get_max_output_frames(max_model_frames);
+
+  // Going there and back, each resampler can come up a frame short of the exact ratio.
+  const double ratio = (double)model_rate / host_rate;
+  const long preload = (long)std::ceil(2.0 + 2.0 / ratio);
+
+  this->_model->prepare(max_model_frames);
+  this->_host_input.resize(kChunkSize);
+  this->_model_audio.resize(max_model_frames);
+  this->_host_output.assign(preload + kChunkSize + max_host_frames, 0.0f);
+  this->_host_output_size = preload;
+  this->_latency = this->_to_model->get_latency() + this->_to_host->get_latency() / ratio + preload;
+}
+
+void nam::ResamplingDSP::process(const float* input, float* output, const int num_frames)
+{
+  this->_process(input, output, num_frames);
+}
+
+void nam::ResamplingDSP::process(const double* input, double* output, const int num_frames)
+{
+  this->_process(input, output, num_frames);
+}
+
+void nam::ResamplingDSP::_prepare_(const int max_num_frames)
+{
+  if (!this->is_resampling())
+    this->_model->prepare(max_num_frames);
+}
+
+void nam::ResamplingDSP::finalize_(const int num_frames)
+{
+  this->DSP::finalize_(num_frames);
+}
+
+template <typename Sample>
+void nam::ResamplingDSP::_process(const Sample* input, Sample* output, const int num_frames)
+{
+  if (!this->is_resampling())
+  {
+    this->_model->process(input, output, num_frames);
+    this->_model->finalize_(num_frames);
+    return;
+  }
+
+  for (int start = 0; start < num_frames; start += kChunkSize)
+  {
+    const int n = std::min(kChunkSize, num_frames - start);
+    const float* host_input;
+    if constexpr (std::is_same_v<Sample, float>)
+      host_input = input + start;
+    else
+    {
+      for (int i = 0; i < n; i++)
+        this->_host_input[i] = (float)input[start + i];
+      host_input = this->_host_input.data();
+    }
+    // The resampler keeps its own copy of the input, so it's fine if the host gave us one buffer for both.
+    const int model_frames = this->_to_model->process(host_input, n, this->_model_audio.data());
+    if (model_frames > 0)
+    {
+      this->_model->process(this->_model_audio.data(), this->_model_audio.data(), model_frames);
+      this->_model->finalize_(model_frames);
+    }
+    this->_host_output_size += this->_to_host->process(
+      this->_model_audio.data(), model_frames, this->_host_output.data() + this->_host_output_size);
+
+    // The preload should make this impossible, but never read past what's there.
+    const long available = std::min((long)n, this->_host_output_size);
+    for (long i = 0; i < available; i++)
+      output[start + i] = (Sample)this->_host_output[i];
+    for (long i = available; i < n; i++)
+      output[start + i] = (Sample)0.0;
+    std::memmove(this->_host_output.data(), this->_host_output.data() + available,
+                 (this->_host_output_size - available) * sizeof(float));
+    this->_host_output_size -= available;
+  }
+}
@@ -0,0 +1,93 @@
+#pragma once
+// Running models at their own sample rate
+//
+// ResamplingDSP wraps a model that expects one sample rate so that a host can run it at another. Host audio is
+// resampled to the model's rate, processed, and resampled back, so a 48kHz model in a 96kHz session only has to
+// compute half as many samples as it would if it were simply run at 96kHz.
+//
+// The resamplers are polyphase FIR filters for the exact ratio between the two rates (e.g. 147/160 for 44.1kHz to
+// 48kHz), designed when the wrapper is built: Kaiser-windowed sinc, about 80dB of stopband, flat up to about 80% of the
+// lower rate's Nyquist frequency. Each output sample is one dot product with a phase of the filter, which Eigen
+// vectorizes. The filters and a few samples of buffering add a fixed latency; see get_latency().
+
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+#include "dsp.h"
+
+namespace nam
+{
+// Changes the sample rate of a mono stream by up / down, a block at a time
+class PolyphaseResampler
+{
+public:
+  // :param up, down: The ratio, in lowest terms
+  // :param max_input_frames: The most frames process() will be given at once
+  PolyphaseResampler(const int up, const int down, const int max_input_frames);
+  // Resample `num_frames` frames of `input` into `output` and return how many frames that made (at most
+  // get_max_output_frames(num_frames)). Realtime-safe.
+  int process(const float* input, const int num_frames, float* output);
+  // The most frames process() can make from `num_frames` frames of input
+  int get_max_output_frames(const int num_frames) const;
+  // The filter's delay, in input samples
+  double get_latency() const;
+
+private:
+  int _up;
+  int _down;
+  // Per phase
+  int _taps;
+  // _up phases of _taps coefficients each, reversed so they line up with the history
+  std::vector<float> _coefficients;
+  // Input samples, oldest first. Starts with _taps - 1 zeros.
+  std::vector<float> _history;
+  long _history_size;
+  // Where the next output comes from: the newest input sample it uses, and the filter phase
+  long _index;
+  int _phase = 0;
+};
+
+// Runs a model at its expected sample rate inside a host running at another one
+class ResamplingDSP : public DSP
+{
+public:
+  // Wrap `model`, which should already be prewarmed, for a host running at `host_sample_rate`. If the model doesn't
+  // know its sample rate or already expects this one, audio goes straight through it. Throws std::runtime_error if
+  // the ratio between the two rates (in lowest terms) is more than kMaxRatioTerm to one.
+  ResamplingDSP(std::unique_ptr<DSP> model, const double host_sample_rate);
+
+  // Calls the model with at most about kChunkSize frames (at the host rate) at a time, and finalizes it.
+  void process(const float* input, float* output, const int num_frames) override;
+  void process(const double* input, double* output, const int num_frames) override;
+  void finalize_(const int num_frames) override;
+  // How far the output lags behind the input, in host samples, on top of whatever latency the model has
+  double get_latency() const { return this->_latency; };
+  bool is_resampling() const { return this->_to_model != nullptr; };
+  DSP& get_model() { return *this->_model; };
+
+  static constexpr int kMaxRatioTerm = 1024;
+
+protected:
+  // The model is prepared for the chunks we give it when resampling; otherwise it sees the host's buffers.
+  void _prepare_(const int max_num_frames) override;
+
+private:
+  static constexpr int kChunkSize = 512;
+
+  std::unique_ptr<DSP> _model;
+  std::unique_ptr<PolyphaseResampler> _to_model;
+  std::unique_ptr<PolyphaseResampler> _to_host;
+  double _latency = 0.0;
+  // Host-rate input as float, and the model-rate audio
+  std::vector<float> _host_input;
+  std::vector<float> _model_audio;
+  // Host-rate output waiting to be handed out. The resamplers don't make exactly as many frames as they're given, so
+  // this starts with a few zeros to never run dry.
+  std::vector<float> _host_output;
+  long _host_output_size;
+
+  template <typename Sample>
+  void _process(const Sample* input, Sample* output, const int num_frames);
+};
+}; // namespace nam
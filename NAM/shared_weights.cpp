@@ -0,0 +1,134 @@
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <system_error>
+
+#include "binary_model.h"
+#include "json_loader.h"
+#include "shared_weights.h"
+
+nam::SharedWeights::SharedWeights(const std::filesystem::path& filename)
+: _file(std::make_shared<const util::MappedFile>(filename))
+{
+  Header header;
+  if (this->_file->size() < sizeof(Header))
+    throw std::runtime_error(filename.string() + " is not a shared weights file");
+  std::memcpy(&header, this->_file->data(), sizeof(Header));
+  if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0)
+    throw std::runtime_error(filename.string() + " is not a shared weights file");
+  if (header.format_version != kFormatVersion)
+  {
+    std::stringstream ss;
+    ss << "Shared weights are format version " << header.format_version << ", but only version " << kFormatVersion
+       << " is supported. Delete " << filename.string() << " to have it recreated.";
+    throw std::runtime_error(ss.str());
+  }
+  if (header.size > (this->_file->size() - sizeof(Header)) / sizeof(float))
+    throw std::runtime_error("Corrupted shared weights: " + filename.string() + " is truncated");
+  this->_data = reinterpret_cast<const float*>(this->_file->data() + sizeof(Header));
+  this->_size = (size_t)header.size;
+  if (header.weight_format > (uint32_t)WeightFormat::kBFloat16)
+    throw std::runtime_error("Corrupted shared weights: unknown weight format");
+  this->_format = (WeightFormat)header.weight_format;
+}
+
+nam::SharedWeights::SharedWeights(std::shared_ptr<const util::MappedFile> file, const float* data, const size_t size,
+                                  const WeightFormat format)
+: _file(std::move(file))
+, _data(data)
+, _size(size)
+, _format(format)
+{
+  if (reinterpret_cast<std::uintptr_t>(data) % WeightArena::kAlignment != 0)
+    throw std::runtime_error("Packed weights must be aligned to " + std::to_string(WeightArena::kAlignment) + " bytes");
+}
+
+void nam::SharedWeights::save(const DSP& model, const std::filesystem::path& filename)
+{
+  const std::span<const float> weights = model.get_packed_weights();
+  Header header = {};
+  std::memcpy(header.magic, kMagic, sizeof(kMagic));
+  header.format_version = kFormatVersion;
+  header.size = weights.size();
+  header.weight_format = (uint32_t)model.get_weight_format();
+
+  // Other processes may be racing to do the same, so everyone writes to a file of their own first.
+  std::random_device random;
+  std::filesystem::path temp_filename = filename;
+  temp_filename += ".tmp" + std::to_string(random());
+  {
+    std::ofstream out(temp_filename, std::ios::binary | std::ios::trunc);
+    if (!out)
+      throw std::runtime_error("Failed to open " + temp_filename.string() + " for writing");
+    out.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+    out.write(reinterpret_cast<const char*>(weights.data()), weights.size() * sizeof(float));
+    out.close();
+    if (!out)
+    {
+      std::filesystem::remove(temp_filename);
+      throw std::runtime_error("Failed to write " + temp_filename.string());
+    }
+  }
+  std::error_code error;
+  std::filesystem::rename(temp_filename, filename, error);
+  if (error)
+  {
+    std::filesystem::remove(temp_filename);
+    // Some platforms won't replace a file that's in use. If someone else got there first, use theirs.
+    if (std::filesystem::exists(filename))
+      return;
+    throw std::runtime_error("Failed to move shared weights into place at " + filename.string() + ": "
+                             + error.message());
+  }
+}
+
+namespace
+{
+// Whether `filename` starts with a header in the magic and format version this build writes. Files that don't were
+// made by something else, or by another version of this code, and get rewritten.
+bool is_current_format(const std::filesystem::path& filename)
+{
+  nam::SharedWeights::Header header;
+  std::ifstream in(filename, std::ios::binary);
+  if (!in.read(reinterpret_cast<char*>(&header), sizeof(header)))
+    return false;
+  return std::memcmp(header.magic, nam::SharedWeights::kMagic, sizeof(nam::SharedWeights::kMagic)) == 0
+         && header.format_version == nam::SharedWeights::kFormatVersion;
+}
+}; // namespace
+
+std::unique_ptr<nam::DSP> nam::get_dsp_shared(const std::filesystem::path& model_file,
+                                              const std::filesystem::path& weights_file)
+{
+  if (!std::filesystem::exists(model_file))
+    throw std::runtime_error("Config JSON doesn't exist!\n");
+  util::MappedFile file(model_file);
+  dspData conf;
+  std::span<const float> model_weights;
+  if (binary_model::is_binary_model(file.data(), file.size()))
+    model_weights = binary_model::parse(file.data(), file.size(), conf);
+  else
+  {
+    json_loader::parse(file.data(), file.size(), conf);
+    model_weights = conf.weights;
+  }
+
+  std::shared_ptr<const SharedWeights> weights;
+  if (std::filesystem::exists(weights_file) && is_current_format(weights_file))
+    weights = std::make_shared<const SharedWeights>(weights_file);
+  std::unique_ptr<DSP> model = get_dsp(conf, model_weights, weights);
+  if (weights != nullptr && model->get_packed_weights().data() == weights->data())
+    return model;
+  // The file isn't there yet or is left over from a different model, so the model packed its own weights: save them
+  // for everyone else, and switch over to the file ourselves. Unmap the old file first, as some platforms won't
+  // replace a file that's in use.
+  weights.reset();
+  SharedWeights::save(*model, weights_file);
+  // If the old file couldn't be replaced after all (another process still has it mapped, say), keep computing with
+  // our own packed weights.
+  if (is_current_format(weights_file))
+    model->use_shared_weights(std::make_shared<const SharedWeights>(weights_file));
+  return model;
+}
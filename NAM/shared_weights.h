@@ -0,0 +1,77 @@
+#pragma once
+// Weights shared between processes
+//
+// A model's packed weights (see weight_arena.h) can be saved to a file that every other instance of the same model,
+// in this process or any other, then maps read-only and computes with in place. N instances share one physical copy
+// in the page cache instead of holding N private ones. Put the file on a tmpfs (e.g. /dev/shm) to keep it out of
+// persistent storage.
+//
+// Layout: a 64-byte header (see below), then the packed weights in the machine's byte order. They're float32, except
+// for the matrices the model stored in half precision, if any (see half_precision.h).
+//
+// Binary models (see binary_model.h) carry packed weights of their own, which get_dsp() uses the same way.
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <span>
+
+#include "dsp.h"
+#include "util.h"
+
+namespace nam
+{
+class SharedWeights
+{
+public:
+  static constexpr char kMagic[4] = {'N', 'A', 'M', 'W'};
+  // Bump this whenever the layout changes, or the way weights are packed.
+  static constexpr uint32_t kFormatVersion = 2;
+
+  struct Header
+  {
+    char magic[4];
+    uint32_t format_version;
+    // Number of floats that follow (half-precision matrices count two values per float)
+    uint64_t size;
+    // A WeightFormat
+    uint32_t weight_format;
+    // Keeps the weights 64-byte aligned
+    char padding[44];
+  };
+  static_assert(sizeof(Header) == WeightArena::kAlignment, "Shared weights header must keep the weights aligned");
+
+  // Map a file written by save().
+  SharedWeights(const std::filesystem::path& filename);
+  // The `size` floats of packed weights at `data`, in `format`, which are part of `file` (e.g. a binary model's).
+  // `data` must be aligned to WeightArena::kAlignment. Keeps the file mapped for as long as they're in use.
+  SharedWeights(std::shared_ptr<const util::MappedFile> file, const float* data, const size_t size,
+                const WeightFormat format);
+
+  const float* data() const { return this->_data; };
+  // In floats
+  size_t get_size() const { return this->_size; };
+  // What the model's big matrices are stored as
+  WeightFormat get_format() const { return this->_format; };
+
+  // Save the packed weights of `model`. The file is written under a temporary name and renamed into place, so
+  // processes opening it never see it half-written.
+  static void save(const DSP& model, const std::filesystem::path& filename);
+
+private:
+  std::shared_ptr<const util::MappedFile> _file;
+  const float* _data = nullptr;
+  size_t _size = 0;
+  WeightFormat _format = WeightFormat::kFloat32;
+};
+
+// Like get_dsp(), but the model computes with the weights in `weights_file`, sharing them with every other instance
+// loaded this way. If the file doesn't exist yet or was made from a different model (or by another format version),
+// it's (re)written from this one; should it still be in use elsewhere and can't be replaced, this instance computes
+// with its own packed weights instead.
+// Each instance still parses the model file and builds its modules from it, to check the shared weights against, but
+// its own copy of the weights only lives until the check is done: it never packs a copy of its own unless it's the one
+// writing the file.
+std::unique_ptr<DSP> get_dsp_shared(const std::filesystem::path& model_file, const std::filesystem::path& weights_file);
+}; // namespace nam
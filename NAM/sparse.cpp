@@ -0,0 +1,128 @@
+#include <algorithm>
+#include <atomic>
+
+#include "sparse.h"
+
+namespace
+{
+constexpr long kRowBlock = nam::SparseMatrix::kRowBlock;
+static_assert(kRowBlock == 4, "The kernels are written for 4x1 blocks");
+typedef Eigen::Matrix<float, kRowBlock, 1> Block;
+std::atomic<float> sparsity_threshold{nam::kDefaultSparsityThreshold};
+
+bool is_zero_block(const Eigen::Ref<const Eigen::MatrixXf>& weights, const long row, const long col)
+{
+  const long n = std::min(kRowBlock, weights.rows() - row);
+  for (long i = 0; i < n; i++)
+    if (weights(row + i, col) != 0.0f)
+      return false;
+  return true;
+}
+
+// output[0:n] (+)= block
+void store(const Block& block, float* output, const long n, const bool accumulate)
+{
+  if (n == kRowBlock)
+  {
+    Eigen::Map<Block> full(output);
+    if (accumulate)
+      full += block;
+    else
+      full = block;
+    return;
+  }
+  for (long i = 0; i < n; i++)
+    output[i] = accumulate ? output[i] + block(i) : block(i);
+}
+}; // namespace
+
+void nam::set_sparsity_threshold(const float threshold)
+{
+  sparsity_threshold.store(threshold, std::memory_order_relaxed);
+}
+
+float nam::get_sparsity_threshold()
+{
+  return sparsity_threshold.load(std::memory_order_relaxed);
+}
+
+float nam::SparseMatrix::get_sparsity(const Eigen::Ref<const Eigen::MatrixXf>& weights)
+{
+  long zero = 0, total = 0;
+  for (long i = 0; i < weights.rows(); i += kRowBlock)
+    for (long j = 0; j < weights.cols(); j++, total++)
+      zero += is_zero_block(weights, i, j);
+  return total > 0 ? (float)zero / total : 0.0f;
+}
+
+nam::SparseMatrix::SparseMatrix(const Eigen::Ref<const Eigen::MatrixXf>& weights)
+: _rows(weights.rows())
+, _cols(weights.cols())
+{
+  for (long i = 0; i < this->_rows; i += kRowBlock)
+  {
+    this->_row_block_starts.push_back((int32_t)this->_columns.size());
+    const long n = std::min(kRowBlock, this->_rows - i);
+    for (long j = 0; j < this->_cols; j++)
+    {
+      if (is_zero_block(weights, i, j))
+        continue;
+      this->_columns.push_back((int32_t)j);
+      for (long r = 0; r < kRowBlock; r++)
+        this->_values.push_back(r < n ? weights(i + r, j) : 0.0f);
+    }
+  }
+  this->_row_block_starts.push_back((int32_t)this->_columns.size());
+}
+
+void nam::SparseMatrix::multiply_(const Eigen::Ref<const Eigen::MatrixXf>& input, Eigen::Ref<Eigen::MatrixXf> output,
+                                  const bool accumulate) const
+{
+  const long num_frames = output.cols();
+  const long input_stride = input.outerStride();
+  const long output_stride = output.outerStride();
+  for (long b = 0, i = 0; i < this->_rows; b++, i += kRowBlock)
+  {
+    const long start = this->_row_block_starts[b];
+    const long n = this->_row_block_starts[b + 1] - start;
+    const float* w = this->_values.data() + start * kRowBlock;
+    const int32_t* columns = this->_columns.data() + start;
+    const long block_rows = std::min(kRowBlock, this->_rows - i);
+    float* out = output.data() + i;
+    // Four frames at a time, so that each block of weights is loaded once for all of them
+    long j = 0;
+    for (; j + 4 <= num_frames; j += 4)
+    {
+      const float* x = input.data() + j * input_stride;
+      Block acc0 = Block::Zero(), acc1 = Block::Zero(), acc2 = Block::Zero(), acc3 = Block::Zero();
+      for (long k = 0; k < n; k++)
+      {
+        const Eigen::Map<const Block> weight(w + k * kRowBlock);
+        const float* xk = x + columns[k];
+        acc0 += weight * xk[0];
+        acc1 += weight * xk[input_stride];
+        acc2 += weight * xk[2 * input_stride];
+        acc3 += weight * xk[3 * input_stride];
+      }
+      store(acc0, out + j * output_stride, block_rows, accumulate);
+      store(acc1, out + (j + 1) * output_stride, block_rows, accumulate);
+      store(acc2, out + (j + 2) * output_stride, block_rows, accumulate);
+      store(acc3, out + (j + 3) * output_stride, block_rows, accumulate);
+    }
+    for (; j < num_frames; j++)
+    {
+      const float* x = input.data() + j * input_stride;
+      // Two accumulators, to overlap the multiply-adds
+      Block acc0 = Block::Zero(), acc1 = Block::Zero();
+      long k = 0;
+      for (; k + 2 <= n; k += 2)
+      {
+        acc0 += Eigen::Map<const Block>(w + k * kRowBlock) * x[columns[k]];
+        acc1 += Eigen::Map<const Block>(w + (k + 1) * kRowBlock) * x[columns[k + 1]];
+      }
+      if (k < n)
+        acc0 += Eigen::Map<const Block>(w + k * kRowBlock) * x[columns[k]];
+      store(acc0 + acc1, out + j * output_stride, block_rows, accumulate);
+    }
+  }
+}
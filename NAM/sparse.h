@@ -0,0 +1,53 @@
+#pragma once
+// Block-sparse weights
+//
+// Pruned models can have many weights that are exactly zero, but Eigen's dense products multiply by them all the same.
+// SparseMatrix keeps only the blocks of kRowBlock rows by one column that aren't all zero, and multiplies with those.
+// Modules give a matrix a sparse copy when enough of its blocks are zero (see DSP::sparsify()); get_dsp() does this
+// for every model it loads, with the threshold from get_sparsity_threshold().
+//
+// The kernel is written with fixed-size Eigen vectors, so it uses whatever SIMD Eigen does for the build.
+
+#include <cstdint>
+#include <vector>
+
+#include <Eigen/Dense>
+
+namespace nam
+{
+// The fraction of all-zero blocks get_dsp() needs to see in a matrix to multiply with a sparse copy of it. Anything
+// above 1 turns sparse kernels off.
+constexpr float kDefaultSparsityThreshold = 0.6f;
+void set_sparsity_threshold(const float threshold);
+float get_sparsity_threshold();
+
+class SparseMatrix
+{
+public:
+  static constexpr long kRowBlock = 4;
+
+  // Fraction of the blocks of `weights` that are all zero (the last block of rows is zero-padded)
+  static float get_sparsity(const Eigen::Ref<const Eigen::MatrixXf>& weights);
+
+  SparseMatrix() = default;
+  SparseMatrix(const Eigen::Ref<const Eigen::MatrixXf>& weights);
+
+  long rows() const { return this->_rows; };
+  long cols() const { return this->_cols; };
+  // Whether there's a matrix here at all (default-constructed ones stand for "use the dense weights")
+  bool empty() const { return this->_rows == 0; };
+  // output = weights * input, or += that if `accumulate`
+  void multiply_(const Eigen::Ref<const Eigen::MatrixXf>& input, Eigen::Ref<Eigen::MatrixXf> output,
+                 const bool accumulate) const;
+
+private:
+  long _rows = 0;
+  long _cols = 0;
+  // The nonzero blocks, a block of rows at a time, kRowBlock values each
+  std::vector<float> _values;
+  // The column of each nonzero block
+  std::vector<int32_t> _columns;
+  // Where each block of rows starts in _columns, plus where the last one ends
+  std::vector<int32_t> _row_block_starts;
+};
+}; // namespace nam
@@ -0,0 +1,65 @@
+#include "thread_pool.h"
+
+nam::ThreadPool::ThreadPool(const size_t num_threads)
+{
+  const size_t n = num_threads > 0 ? num_threads : default_num_threads();
+  this->_threads.reserve(n);
+  for (size_t i = 0; i < n; i++)
+    this->_threads.emplace_back(&ThreadPool::_worker, this);
+}
+
+nam::ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(this->_mutex);
+    this->_stop = true;
+  }
+  this->_task_available.notify_all();
+  for (auto& thread : this->_threads)
+    thread.join();
+}
+
+size_t nam::ThreadPool::default_num_threads()
+{
+  const unsigned int n = std::thread::hardware_concurrency();
+  return n > 0 ? n : 1;
+}
+
+void nam::ThreadPool::submit(std::function<void()> task)
+{
+  {
+    std::lock_guard<std::mutex> lock(this->_mutex);
+    this->_tasks.push(std::move(task));
+    this->_pending++;
+  }
+  this->_task_available.notify_one();
+}
+
+void nam::ThreadPool::wait()
+{
+  std::unique_lock<std::mutex> lock(this->_mutex);
+  this->_idle.wait(lock, [this] { return this->_pending == 0; });
+}
+
+void nam::ThreadPool::_worker()
+{
+  while (true)
+  {
+    std::function<void()> task;
+    {
+      std::unique_lock<std::mutex> lock(this->_mutex);
+      this->_task_available.wait(lock, [this] { return this->_stop || !this->_tasks.empty(); });
+      // Drain the queue before stopping
+      if (this->_tasks.empty())
+        return;
+      task = std::move(this->_tasks.front());
+      this->_tasks.pop();
+    }
+    task();
+    {
+      std::lock_guard<std::mutex> lock(this->_mutex);
+      if (--this->_pending == 0)
+        this->_idle.notify_all();
+    }
+  }
+}
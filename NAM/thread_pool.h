@@ -0,0 +1,48 @@
+#pragma once
+// A small fixed-size pool of worker threads
+//
+// Used for non-realtime work that parallelizes well, like loading many models at once. Tasks run in the order they
+// were submitted, on whichever worker is free.
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <vector>
+
+namespace nam
+{
+class ThreadPool
+{
+public:
+  // 0 threads means one per hardware thread.
+  ThreadPool(const size_t num_threads = 0);
+  // Finishes the queued tasks before returning.
+  ~ThreadPool();
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // Queue a task. Tasks must not throw; catch and report errors inside the task.
+  void submit(std::function<void()> task);
+  // Block until every task submitted so far has finished.
+  void wait();
+  size_t get_num_threads() const { return this->_threads.size(); };
+
+  // What "0 threads" resolves to
+  static size_t default_num_threads();
+
+private:
+  std::vector<std::thread> _threads;
+  std::mutex _mutex;
+  std::condition_variable _task_available;
+  std::condition_variable _idle;
+  std::queue<std::function<void()>> _tasks;
+  // Tasks queued or running
+  size_t _pending = 0;
+  bool _stop = false;
+
+  void _worker();
+};
+}; // namespace nam
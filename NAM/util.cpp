@@ -1,5 +1,15 @@
 #include <algorithm>
 #include <cctype>
+#include <stdexcept>
+
+#ifdef _WIN32
+  #include <windows.h>
+#else
+  #include <fcntl.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <unistd.h>
+#endif
 
 #include "util.h"
 
@@ -9,3 +19,82 @@ std::string nam::util::lowercase(const std::string& s)
   std::transform(s.begin(), s.end(), out.begin(), [](unsigned char c) { return std::tolower(c); });
   return out;
 }
+
+#ifdef _WIN32
+
+nam::util::MappedFile::MappedFile(const std::filesystem::path& filename)
+{
+  HANDLE file = CreateFileW(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                            FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE)
+    throw std::runtime_error("Failed to open " + filename.string());
+  LARGE_INTEGER size;
+  if (!GetFileSizeEx(file, &size))
+  {
+    CloseHandle(file);
+    throw std::runtime_error("Failed to get the size of " + filename.string());
+  }
+  this->_file = file;
+  this->_size = (size_t)size.QuadPart;
+  // Can't map an empty file.
+  if (this->_size == 0)
+    return;
+  HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+  const void* view = mapping != nullptr ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+  if (view == nullptr)
+  {
+    if (mapping != nullptr)
+      CloseHandle(mapping);
+    CloseHandle(file);
+    throw std::runtime_error("Failed to map " + filename.string());
+  }
+  this->_mapping = mapping;
+  this->_data = (const char*)view;
+}
+
+nam::util::MappedFile::~MappedFile()
+{
+  if (this->_data != nullptr)
+    UnmapViewOfFile(this->_data);
+  if (this->_mapping != nullptr)
+    CloseHandle(this->_mapping);
+  if (this->_file != nullptr)
+    CloseHandle(this->_file);
+}
+
+#else
+
+nam::util::MappedFile::MappedFile(const std::filesystem::path& filename)
+{
+  const int fd = open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw std::runtime_error("Failed to open " + filename.string());
+  struct stat st;
+  if (fstat(fd, &st) != 0)
+  {
+    close(fd);
+    throw std::runtime_error("Failed to get the size of " + filename.string());
+  }
+  this->_size = (size_t)st.st_size;
+  // Can't map an empty file.
+  if (this->_size > 0)
+  {
+    void* mapping = mmap(nullptr, this->_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (mapping == MAP_FAILED)
+    {
+      close(fd);
+      throw std::runtime_error("Failed to map " + filename.string());
+    }
+    this->_data = (const char*)mapping;
+  }
+  // The mapping keeps its own reference to the file.
+  close(fd);
+}
+
+nam::util::MappedFile::~MappedFile()
+{
+  if (this->_data != nullptr)
+    munmap((void*)this->_data, this->_size);
+}
+
+#endif
@@ -2,6 +2,8 @@
 
 // Utilities
 
+#include <cstddef>
+#include <filesystem>
 #include <string>
 #include <Eigen/Dense> // Eigen::MatrixXf
 
@@ -10,5 +12,27 @@ namespace nam
 namespace util
 {
 std::string lowercase(const std::string& s);
+
+// Read-only memory mapping of a whole file.
+// The contents stay valid for as long as the object is alive.
+class MappedFile
+{
+public:
+  MappedFile(const std::filesystem::path& filename);
+  ~MappedFile();
+  MappedFile(const MappedFile&) = delete;
+  MappedFile& operator=(const MappedFile&) = delete;
+
+  const char* data() const { return this->_data; };
+  size_t size() const { return this->_size; };
+
+private:
+  const char* _data = nullptr;
+  size_t _size = 0;
+#ifdef _WIN32
+  void* _file = nullptr;
+  void* _mapping = nullptr;
+#endif
+};
 }; // namespace util
 }; // namespace nam
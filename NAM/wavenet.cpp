@@ -1,4 +1,5 @@
 #include <algorithm>
+#include <cmath>
 #include <iostream>
 #include <math.h>
 
@@ -12,47 +13,94 @@ nam::wavenet::_DilatedConv::_DilatedConv(const int in_channels, const int out_ch
   this->set_size_(in_channels, out_channels, kernel_size, bias, dilation);
 }
 
-void nam::wavenet::_Layer::set_weights_(std::vector<float>::iterator& weights)
+void nam::wavenet::_Layer::set_weights_(weights_it& weights)
 {
   this->_conv.set_weights_(weights);
   this->_input_mixin.set_weights_(weights);
   this->_1x1.set_weights_(weights);
 }
 
-void nam::wavenet::_Layer::process_(const Eigen::MatrixXf& input, const Eigen::MatrixXf& condition,
-                                    Eigen::MatrixXf& head_input, Eigen::MatrixXf& output, const long i_start,
-                                    const long j_start)
+void nam::wavenet::_Layer::process_(const Eigen::MatrixXf& input, const Eigen::Ref<const Eigen::MatrixXf>& condition,
+                                    Eigen::Ref<Eigen::MatrixXf> head_input, Eigen::Ref<Eigen::MatrixXf> output,
+                                    const long i_start, const long j_start)
 {
   const long ncols = condition.cols();
-  const long channels = this->get_channels();
+  const long channels = this->get_z_channels();
+  auto z = this->_z.leftCols(ncols);
+  auto mixin = this->_mixin.leftCols(ncols);
   // Input dilated conv
-  this->_conv.process_(input, this->_z, i_start, ncols, 0);
+  this->_conv.process_(input, z, i_start, ncols, 0);
   // Mix-in condition
-  this->_z += this->_input_mixin.process(condition);
+  this->_input_mixin.process_(condition, mixin);
+  z += mixin;
 
-  this->_activation->apply(this->_z);
+  this->_activation->apply(z);
 
   if (this->_gated)
   {
-    activations::Activation::get_activation("Sigmoid")->apply(this->_z.block(channels, 0, channels, this->_z.cols()));
+    activations::Activation::get_activation("Sigmoid")->apply(this->_z.block(channels, 0, channels, ncols));
 
-    this->_z.topRows(channels).array() *= this->_z.bottomRows(channels).array();
+    z.topRows(channels).array() *= z.bottomRows(channels).array();
     // this->_z.topRows(channels) = this->_z.topRows(channels).cwiseProduct(
     //   this->_z.bottomRows(channels)
     // );
   }
 
-  head_input += this->_z.topRows(channels);
-  output.middleCols(j_start, ncols) = input.middleCols(i_start, ncols) + this->_1x1.process(this->_z.topRows(channels));
+  head_input += z.topRows(channels);
+  auto layer_output = output.middleCols(j_start, ncols);
+  this->_1x1.process_(z.topRows(channels), layer_output);
+  layer_output += input.middleCols(i_start, ncols);
 }
 
-void nam::wavenet::_Layer::set_num_frames_(const long num_frames)
+void nam::wavenet::_Layer::pack_(WeightArena& arena)
 {
-  if (this->_z.rows() == this->_conv.get_out_channels() && this->_z.cols() == num_frames)
-    return; // Already has correct size
+  this->_conv.pack_(arena);
+  this->_input_mixin.pack_(arena);
+  this->_1x1.pack_(arena);
+}
+
+void nam::wavenet::_Layer::quantize_int8_()
+{
+  // The input mixin is left alone: with so few input channels, quantizing its input costs more than it saves.
+  this->_conv.quantize_int8_();
+  this->_1x1.quantize_int8_();
+}
+
+int nam::wavenet::_Layer::sparsify_(const float threshold)
+{
+  return this->_conv.sparsify_(threshold) + this->_input_mixin.sparsify_(threshold) + this->_1x1.sparsify_(threshold);
+}
+
+void nam::wavenet::_Layer::factorize_low_rank_(const float max_error, const std::string& name,
+                                               std::vector<LowRankReport>& report)
+{
+  report.push_back(this->_input_mixin.factorize_low_rank_(max_error, name + "._input_mixin"));
+  report.push_back(this->_1x1.factorize_low_rank_(max_error, name + "._1x1"));
+}
 
-  this->_z.resize(this->_conv.get_out_channels(), num_frames);
+void nam::wavenet::_Layer::select_channels_(const prune::Channels& residual, const prune::Channels& z)
+{
+  // Gated convolutions put the gates for the channels of _z after them
+  const prune::Channels conv_out = this->_gated ? prune::with_offset(z, this->get_z_channels()) : z;
+  this->_conv.select_channels_(conv_out, residual);
+  this->_input_mixin.select_channels_(conv_out, prune::all(this->_input_mixin.get_in_channels()));
+  this->_1x1.select_channels_(residual, z);
+  this->_z.resize(this->_conv.get_out_channels(), this->_z.cols());
   this->_z.setZero();
+  this->_mixin.resize(this->_conv.get_out_channels(), this->_mixin.cols());
+}
+
+void nam::wavenet::_Layer::set_max_num_frames_(const long max_num_frames)
+{
+  this->_conv.reserve_(max_num_frames);
+  this->_input_mixin.reserve_(max_num_frames);
+  this->_1x1.reserve_(max_num_frames);
+  if (this->_z.rows() == this->_conv.get_out_channels() && this->_z.cols() >= max_num_frames)
+    return; // Already big enough
+
+  this->_z.resize(this->_conv.get_out_channels(), max_num_frames);
+  this->_z.setZero();
+  this->_mixin.resize(this->_conv.get_out_channels(), max_num_frames);
 }
 
 // LayerArray =================================================================
@@ -65,14 +113,13 @@ nam::wavenet::_LayerArray::_LayerArray(const int input_size, const int condition
 : _rechannel(input_size, channels, false)
 , _head_rechannel(channels, head_size, head_bias)
 {
+  this->_layers.reserve(dilations.size());
   for (size_t i = 0; i < dilations.size(); i++)
-    this->_layers.push_back(_Layer(condition_size, channels, kernel_size, dilations[i], activation, gated));
+    this->_layers.emplace_back(condition_size, channels, kernel_size, dilations[i], activation, gated);
   const long receptive_field = this->_get_receptive_field();
+  this->_layer_buffers.reserve(dilations.size());
   for (size_t i = 0; i < dilations.size(); i++)
-  {
-    this->_layer_buffers.push_back(Eigen::MatrixXf(channels, LAYER_ARRAY_BUFFER_SIZE + receptive_field - 1));
-    this->_layer_buffers[i].setZero();
-  }
+    this->_layer_buffers.push_back(Eigen::MatrixXf::Zero(channels, LAYER_ARRAY_BUFFER_SIZE + receptive_field - 1));
   this->_buffer_start = this->_get_receptive_field() - 1;
 }
 
@@ -89,6 +136,11 @@ long nam::wavenet::_LayerArray::get_receptive_field() const
   return result;
 }
 
+long nam::wavenet::_LayerArray::get_max_num_frames() const
+{
+  return LAYER_ARRAY_BUFFER_SIZE - this->_get_receptive_field();
+}
+
 void nam::wavenet::_LayerArray::prepare_for_frames_(const long num_frames)
 {
   // Example:
@@ -102,38 +154,41 @@ void nam::wavenet::_LayerArray::prepare_for_frames_(const long num_frames)
     this->_rewind_buffers_();
 }
 
-void nam::wavenet::_LayerArray::process_(const Eigen::MatrixXf& layer_inputs, const Eigen::MatrixXf& condition,
-                                         Eigen::MatrixXf& head_inputs, Eigen::MatrixXf& layer_outputs,
-                                         Eigen::MatrixXf& head_outputs)
+void nam::wavenet::_LayerArray::process_(const Eigen::Ref<const Eigen::MatrixXf>& layer_inputs,
+                                         const Eigen::Ref<const Eigen::MatrixXf>& condition,
+                                         Eigen::Ref<Eigen::MatrixXf> head_inputs,
+                                         Eigen::Ref<Eigen::MatrixXf> layer_outputs,
+                                         Eigen::Ref<Eigen::MatrixXf> head_outputs)
 {
-  this->_layer_buffers[0].middleCols(this->_buffer_start, layer_inputs.cols()) = this->_rechannel.process(layer_inputs);
+  this->_rechannel.process_(layer_inputs, this->_layer_buffers[0].middleCols(this->_buffer_start, layer_inputs.cols()));
   const size_t last_layer = this->_layers.size() - 1;
   for (size_t i = 0; i < this->_layers.size(); i++)
   {
-    this->_layers[i].process_(this->_layer_buffers[i], condition, head_inputs,
-                              i == last_layer ? layer_outputs : this->_layer_buffers[i + 1], this->_buffer_start,
-                              i == last_layer ? 0 : this->_buffer_start);
+    this->_layers[i].process_(
+      this->_layer_buffers[i], condition, head_inputs,
+      i == last_layer ? layer_outputs : Eigen::Ref<Eigen::MatrixXf>(this->_layer_buffers[i + 1]), this->_buffer_start,
+      i == last_layer ? 0 : this->_buffer_start);
   }
-  head_outputs = this->_head_rechannel.process(head_inputs);
+  this->_head_rechannel.process_(head_inputs, head_outputs);
 }
 
-void nam::wavenet::_LayerArray::set_num_frames_(const long num_frames)
+void nam::wavenet::_LayerArray::set_max_num_frames_(const long max_num_frames)
 {
-  // Wavenet checks for unchanged num_frames; if we made it here, there's
-  // something to do.
-  if (LAYER_ARRAY_BUFFER_SIZE - num_frames < this->_get_receptive_field())
+  if (LAYER_ARRAY_BUFFER_SIZE - max_num_frames < this->_get_receptive_field())
   {
     std::stringstream ss;
-    ss << "Asked to accept a buffer of " << num_frames << " samples, but the buffer is too short ("
+    ss << "Asked to accept a buffer of " << max_num_frames << " samples, but the buffer is too short ("
        << LAYER_ARRAY_BUFFER_SIZE << ") to get out of the recptive field (" << this->_get_receptive_field()
        << "); copy errors could occur!\n";
     throw std::runtime_error(ss.str().c_str());
   }
+  this->_rechannel.reserve_(max_num_frames);
   for (size_t i = 0; i < this->_layers.size(); i++)
-    this->_layers[i].set_num_frames_(num_frames);
+    this->_layers[i].set_max_num_frames_(max_num_frames);
+  this->_head_rechannel.reserve_(max_num_frames);
 }
 
-void nam::wavenet::_LayerArray::set_weights_(std::vector<float>::iterator& weights)
+void nam::wavenet::_LayerArray::set_weights_(weights_it& weights)
 {
   this->_rechannel.set_weights_(weights);
   for (size_t i = 0; i < this->_layers.size(); i++)
@@ -141,6 +196,49 @@ void nam::wavenet::_LayerArray::set_weights_(std::vector<float>::iterator& weigh
   this->_head_rechannel.set_weights_(weights);
 }
 
+void nam::wavenet::_LayerArray::pack_(WeightArena& arena)
+{
+  this->_rechannel.pack_(arena);
+  for (auto& layer : this->_layers)
+    layer.pack_(arena);
+  this->_head_rechannel.pack_(arena);
+}
+
+void nam::wavenet::_LayerArray::quantize_int8_()
+{
+  this->_rechannel.quantize_int8_();
+  for (auto& layer : this->_layers)
+    layer.quantize_int8_();
+  this->_head_rechannel.quantize_int8_();
+}
+
+int nam::wavenet::_LayerArray::sparsify_(const float threshold)
+{
+  int num_sparse = this->_rechannel.sparsify_(threshold);
+  for (auto& layer : this->_layers)
+    num_sparse += layer.sparsify_(threshold);
+  return num_sparse + this->_head_rechannel.sparsify_(threshold);
+}
+
+void nam::wavenet::_LayerArray::factorize_low_rank_(const float max_error, const std::string& name,
+                                                    std::vector<LowRankReport>& report)
+{
+  for (size_t i = 0; i < this->_layers.size(); i++)
+    this->_layers[i].factorize_low_rank_(max_error, name + ".layers[" + std::to_string(i) + "]", report);
+  report.push_back(this->_head_rechannel.factorize_low_rank_(max_error, name + "._head_rechannel"));
+}
+
+void nam::wavenet::_LayerArray::select_channels_(const prune::Channels& input, const prune::Channels& residual,
+                                                 const prune::Channels& z, const prune::Channels& head_output)
+{
+  this->_rechannel.select_channels_(residual, input);
+  for (auto& layer : this->_layers)
+    layer.select_channels_(residual, z);
+  for (auto& buffer : this->_layer_buffers)
+    buffer = prune::select(buffer, residual, prune::all(buffer.cols()));
+  this->_head_rechannel.select_channels_(head_output, z);
+}
+
 long nam::wavenet::_LayerArray::_get_channels() const
 {
   return this->_layers.size() > 0 ? this->_layers[0].get_channels() : 0;
@@ -186,7 +284,7 @@ nam::wavenet::_Head::_Head(const int input_size, const int num_layers, const int
   }
 }
 
-void nam::wavenet::_Head::set_weights_(std::vector<float>::iterator& weights)
+void nam::wavenet::_Head::set_weights_(weights_it& weights)
 {
   for (size_t i = 0; i < this->_layers.size(); i++)
     this->_layers[i].set_weights_(weights);
@@ -195,30 +293,32 @@ void nam::wavenet::_Head::set_weights_(std::vector<float>::iterator& weights)
 void nam::wavenet::_Head::process_(Eigen::MatrixXf& inputs, Eigen::MatrixXf& outputs)
 {
   const size_t num_layers = this->_layers.size();
+  const long num_frames = inputs.cols();
   this->_apply_activation_(inputs);
   if (num_layers == 1)
     outputs = this->_layers[0].process(inputs);
   else
   {
-    this->_buffers[0] = this->_layers[0].process(inputs);
+    this->_layers[0].process_(inputs, this->_buffers[0].leftCols(num_frames));
     for (size_t i = 1; i < num_layers; i++)
     { // Asserted > 0 layers
-      this->_apply_activation_(this->_buffers[i - 1]);
+      auto previous = this->_buffers[i - 1].leftCols(num_frames);
+      this->_activation->apply(previous);
       if (i < num_layers - 1)
-        this->_buffers[i] = this->_layers[i].process(this->_buffers[i - 1]);
+        this->_layers[i].process_(previous, this->_buffers[i].leftCols(num_frames));
       else
-        outputs = this->_layers[i].process(this->_buffers[i - 1]);
+        outputs = this->_layers[i].process(previous);
     }
   }
 }
 
-void nam::wavenet::_Head::set_num_frames_(const long num_frames)
+void nam::wavenet::_Head::set_max_num_frames_(const long max_num_frames)
 {
   for (size_t i = 0; i < this->_buffers.size(); i++)
   {
-    if (this->_buffers[i].rows() == this->_channels && this->_buffers[i].cols() == num_frames)
-      continue; // Already has correct size
-    this->_buffers[i].resize(this->_channels, num_frames);
+    if (this->_buffers[i].rows() == this->_channels && this->_buffers[i].cols() >= max_num_frames)
+      continue; // Already big enough
+    this->_buffers[i].resize(this->_channels, max_num_frames);
     this->_buffers[i].setZero();
   }
 }
@@ -231,20 +331,21 @@ void nam::wavenet::_Head::_apply_activation_(Eigen::MatrixXf& x)
 // WaveNet ====================================================================
 
 nam::wavenet::WaveNet::WaveNet(const std::vector<nam::wavenet::LayerArrayParams>& layer_array_params,
-                               const float head_scale, const bool with_head, std::vector<float> weights,
+                               const float head_scale, const bool with_head, std::span<const float> weights,
                                const double expected_sample_rate)
 : DSP(expected_sample_rate)
-, _num_frames(0)
+, _max_num_frames(0)
 , _head_scale(head_scale)
 {
   if (with_head)
     throw std::runtime_error("Head not implemented!");
+  this->_layer_arrays.reserve(layer_array_params.size());
   for (size_t i = 0; i < layer_array_params.size(); i++)
   {
-    this->_layer_arrays.push_back(nam::wavenet::_LayerArray(
+    this->_layer_arrays.emplace_back(
       layer_array_params[i].input_size, layer_array_params[i].condition_size, layer_array_params[i].head_size,
       layer_array_params[i].channels, layer_array_params[i].kernel_size, layer_array_params[i].dilations,
-      layer_array_params[i].activation, layer_array_params[i].gated, layer_array_params[i].head_bias));
+      layer_array_params[i].activation, layer_array_params[i].gated, layer_array_params[i].head_bias);
     this->_layer_array_outputs.push_back(Eigen::MatrixXf(layer_array_params[i].channels, 0));
     if (i == 0)
       this->_head_arrays.push_back(Eigen::MatrixXf(layer_array_params[i].channels, 0));
@@ -272,9 +373,9 @@ void nam::wavenet::WaveNet::finalize_(const int num_frames)
   this->_advance_buffers_(num_frames);
 }
 
-void nam::wavenet::WaveNet::set_weights_(std::vector<float>& weights)
+void nam::wavenet::WaveNet::set_weights_(std::span<const float> weights)
 {
-  std::vector<float>::iterator it = weights.begin();
+  weights_it it = weights.begin();
   for (size_t i = 0; i < this->_layer_arrays.size(); i++)
     this->_layer_arrays[i].set_weights_(it);
   // this->_head.set_params_(it);
@@ -293,6 +394,178 @@ void nam::wavenet::WaveNet::set_weights_(std::vector<float>& weights)
   }
 }
 
+void nam::wavenet::WaveNet::_pack_weights_(WeightArena& arena)
+{
+  for (auto& layer_array : this->_layer_arrays)
+    layer_array.pack_(arena);
+}
+
+void nam::wavenet::WaveNet::_quantize_int8_()
+{
+  for (auto& layer_array : this->_layer_arrays)
+    layer_array.quantize_int8_();
+}
+
+int nam::wavenet::WaveNet::_sparsify_(const float threshold)
+{
+  int num_sparse = 0;
+  for (auto& layer_array : this->_layer_arrays)
+    num_sparse += layer_array.sparsify_(threshold);
+  return num_sparse;
+}
+
+void nam::wavenet::WaveNet::_factorize_low_rank_(const float max_error, std::vector<LowRankReport>& report)
+{
+  for (size_t i = 0; i < this->_layer_arrays.size(); i++)
+    this->_layer_arrays[i].factorize_low_rank_(max_error, "layer_arrays[" + std::to_string(i) + "]", report);
+}
+
+namespace
+{
+// Copies of a layer array's weights for finding dead channels. Indices are the channels' original ones throughout.
+struct LayerWeights
+{
+  std::vector<Eigen::MatrixXf> conv;
+  Eigen::VectorXf conv_bias;
+  Eigen::MatrixXf input_mixin;
+  Eigen::MatrixXf conv_1x1;
+  Eigen::VectorXf bias_1x1;
+  nam::activations::Activation* activation;
+  bool gated;
+  long z_channels;
+};
+
+struct LayerArrayWeights
+{
+  Eigen::MatrixXf rechannel;
+  std::vector<LayerWeights> layers;
+  Eigen::MatrixXf head_rechannel;
+  Eigen::VectorXf head_bias;
+};
+
+LayerArrayWeights copy_weights(const nam::wavenet::_LayerArray& layer_array)
+{
+  LayerArrayWeights weights;
+  weights.rechannel = layer_array.get_rechannel().get_weight();
+  for (const auto& layer : layer_array.get_layers())
+  {
+    LayerWeights& w = weights.layers.emplace_back();
+    for (long k = 0; k < layer.get_kernel_size(); k++)
+      w.conv.push_back(layer.get_conv().get_weight(k));
+    w.conv_bias = layer.get_conv().get_bias();
+    w.input_mixin = layer.get_input_mixin().get_weight();
+    w.conv_1x1 = layer.get_1x1().get_weight();
+    w.bias_1x1 = layer.get_1x1().get_bias();
+    w.activation = layer.get_activation();
+    w.gated = layer.is_gated();
+    w.z_channels = layer.get_z_channels();
+  }
+  weights.head_rechannel = layer_array.get_head_rechannel().get_weight();
+  weights.head_bias = layer_array.get_head_rechannel().get_bias();
+  return weights;
+}
+
+// Whether channel c of a (non-gated) layer's _z is always (close to) zero: its row of the convolution is, once
+// activated
+bool is_dead_z(const LayerWeights& layer, const long c, const nam::prune::Channels& residual, const float tolerance)
+{
+  for (const auto& tap : layer.conv)
+    if (!nam::prune::row_is_negligible(tap, c, residual, tolerance))
+      return false;
+  if (!nam::prune::row_is_negligible(layer.input_mixin, c, nam::prune::all(layer.input_mixin.cols()), tolerance))
+    return false;
+  const float bias = layer.conv_bias.size() > 0 ? layer.conv_bias(c) : 0.0f;
+  return std::abs(nam::prune::activate(layer.activation, bias)) <= tolerance;
+}
+}; // namespace
+
+void nam::wavenet::WaveNet::_prune_channels_(const float tolerance, std::vector<PrunedChannels>& report)
+{
+  const size_t num_arrays = this->_layer_arrays.size();
+  std::vector<LayerArrayWeights> weights;
+  // The channels still alive in each layer array: of the residual stream between its layers, and of its layers' _z
+  // (which are also those of its head input, and of the previous array's head output).
+  std::vector<prune::Channels> residual, z;
+  for (const auto& layer_array : this->_layer_arrays)
+  {
+    weights.push_back(copy_weights(layer_array));
+    residual.push_back(prune::all(weights.back().rechannel.rows()));
+    z.push_back(prune::all(weights.back().head_rechannel.cols()));
+  }
+  const prune::Channels condition = prune::all(num_arrays > 0 ? weights[0].rechannel.cols() : 0);
+  const prune::Channels output = prune::all(1);
+  auto input_of = [&](const size_t i) -> const prune::Channels& { return i == 0 ? condition : residual[i - 1]; };
+  auto head_output_of = [&](const size_t i) -> const prune::Channels& {
+    return i + 1 < num_arrays ? z[i + 1] : output;
+  };
+
+  // A channel is dead if nothing reads it, or if it's always zero. Each one dropped can kill others, so go until
+  // nothing changes.
+  bool changed = true;
+  while (changed)
+  {
+    changed = false;
+    for (size_t i = 0; i < num_arrays; i++)
+    {
+      const LayerArrayWeights& w = weights[i];
+      prune::Channels alive;
+      for (const long r : residual[i])
+      {
+        // The next array reads the residual stream after the last layer
+        bool read =
+          i + 1 < num_arrays && !prune::col_is_negligible(weights[i + 1].rechannel, residual[i + 1], r, tolerance);
+        bool written = !prune::row_is_negligible(w.rechannel, r, input_of(i), tolerance);
+        for (const auto& layer : w.layers)
+        {
+          const prune::Channels conv_rows = layer.gated ? prune::with_offset(z[i], layer.z_channels) : z[i];
+          for (const auto& tap : layer.conv)
+            read = read || !prune::col_is_negligible(tap, conv_rows, r, tolerance);
+          written = written || !prune::row_is_negligible(layer.conv_1x1, r, z[i], tolerance)
+                    || (layer.bias_1x1.size() > 0 && std::abs(layer.bias_1x1(r)) > tolerance);
+        }
+        if (read && written)
+          alive.push_back(r);
+      }
+      changed = changed || alive.size() < residual[i].size();
+      residual[i] = alive;
+
+      // The gate activation in _Layer::process_() goes over a stretch of _z's memory rather than just the gate rows,
+      // so gated layers only compute the same thing if _z keeps its shape (see prune.h).
+      if (!w.layers.empty() && w.layers[0].gated)
+        continue;
+      alive.clear();
+      for (const long c : z[i])
+      {
+        bool read = !prune::col_is_negligible(w.head_rechannel, head_output_of(i), c, tolerance);
+        // Earlier arrays' head outputs come in on the same channels
+        const LayerArrayWeights* previous = i > 0 ? &weights[i - 1] : nullptr;
+        bool written = previous != nullptr
+                       && (!prune::row_is_negligible(previous->head_rechannel, c, z[i - 1], tolerance)
+                           || (previous->head_bias.size() > 0 && std::abs(previous->head_bias(c)) > tolerance));
+        for (const auto& layer : w.layers)
+        {
+          read = read || !prune::col_is_negligible(layer.conv_1x1, residual[i], c, tolerance);
+          written = written || !is_dead_z(layer, c, residual[i], tolerance);
+        }
+        if (read && written)
+          alive.push_back(c);
+      }
+      changed = changed || alive.size() < z[i].size();
+      z[i] = alive;
+    }
+  }
+
+  for (size_t i = 0; i < num_arrays; i++)
+  {
+    const std::string name = "layer_arrays[" + std::to_string(i) + "]";
+    report.push_back({name + " residual", weights[i].rechannel.rows(), (long)residual[i].size()});
+    report.push_back({name + " layer", weights[i].head_rechannel.cols(), (long)z[i].size()});
+    this->_layer_arrays[i].select_channels_(input_of(i), residual[i], z[i], head_output_of(i));
+    this->_layer_array_outputs[i].resize(residual[i].size(), this->_layer_array_outputs[i].cols());
+    this->_head_arrays[i].resize(z[i].size(), this->_head_arrays[i].cols());
+  }
+}
+
 void nam::wavenet::WaveNet::_advance_buffers_(const int num_frames)
 {
   for (size_t i = 0; i < this->_layer_arrays.size(); i++)
@@ -305,59 +578,82 @@ void nam::wavenet::WaveNet::_prepare_for_frames_(const long num_frames)
     this->_layer_arrays[i].prepare_for_frames_(num_frames);
 }
 
-void nam::wavenet::WaveNet::_set_condition_array(NAM_SAMPLE* input, const int num_frames)
+Eigen::Ref<const Eigen::MatrixXf> nam::wavenet::WaveNet::_get_condition(const float* input, const int num_frames)
 {
-  for (int j = 0; j < num_frames; j++)
-  {
-    this->_condition(0, j) = input[j];
-  }
+  return Eigen::Map<const Eigen::MatrixXf>(input, 1, num_frames);
 }
 
-void nam::wavenet::WaveNet::process(NAM_SAMPLE* input, NAM_SAMPLE* output, const int num_frames)
+void nam::wavenet::WaveNet::_process_(const float* input, float* output, const int num_frames)
 {
-  this->_set_num_frames_(num_frames);
+  if (num_frames > this->_max_num_frames)
+    this->_prepare_(num_frames); // Not prepared for this many
   this->_prepare_for_frames_(num_frames);
-  this->_set_condition_array(input, num_frames);
+  const Eigen::Ref<const Eigen::MatrixXf> condition = this->_get_condition(input, num_frames);
 
   // Main layer arrays:
   // Layer-to-layer
   // Sum on head output
-  this->_head_arrays[0].setZero();
+  // The last one writes its head output straight to `output`.
+  Eigen::Map<Eigen::MatrixXf> final_head_output(output, 1, num_frames);
+  assert(this->_head_arrays.back().rows() == 1);
+  this->_head_arrays[0].leftCols(num_frames).setZero();
   for (size_t i = 0; i < this->_layer_arrays.size(); i++)
-    this->_layer_arrays[i].process_(i == 0 ? this->_condition : this->_layer_array_outputs[i - 1], this->_condition,
-                                    this->_head_arrays[i], this->_layer_array_outputs[i], this->_head_arrays[i + 1]);
+  {
+    const bool last = i + 1 == this->_layer_arrays.size();
+    this->_layer_arrays[i].process_(
+      i == 0 ? condition : Eigen::Ref<const Eigen::MatrixXf>(this->_layer_array_outputs[i - 1].leftCols(num_frames)),
+      condition, this->_head_arrays[i].leftCols(num_frames), this->_layer_array_outputs[i].leftCols(num_frames),
+      last ? Eigen::Ref<Eigen::MatrixXf>(final_head_output)
+           : Eigen::Ref<Eigen::MatrixXf>(this->_head_arrays[i + 1].leftCols(num_frames)));
+  }
   // this->_head.process_(
   //   this->_head_input,
   //   this->_head_output
   //);
-  //  Copy to required output array
   //  Hack: apply head scale here; revisit when/if I activate the head.
-  //  assert(this->_head_output.rows() == 1);
+  final_head_output *= this->_head_scale;
+}
 
-  const long final_head_array = this->_head_arrays.size() - 1;
-  assert(this->_head_arrays[final_head_array].rows() == 1);
-  for (int s = 0; s < num_frames; s++)
+int nam::wavenet::WaveNet::_get_render_block_size_() const
+{
+  // A layer reads its input and the condition, and writes _z, its output and the head input
+  long floats_per_frame = 1;
+  long max_num_frames = LAYER_ARRAY_BUFFER_SIZE;
+  for (const auto& layer_array : this->_layer_arrays)
   {
-    float out = this->_head_scale * this->_head_arrays[final_head_array](0, s);
-    output[s] = out;
+    for (const auto& layer : layer_array.get_layers())
+      floats_per_frame = std::max(floats_per_frame, 2 * layer.get_channels() + layer.get_conv().get_out_channels()
+                                                      + layer.get_z_channels() + layer.get_input_mixin().get_in_channels());
+    max_num_frames = std::min(max_num_frames, layer_array.get_max_num_frames());
   }
+  return (int)std::max(1L, std::min((long)_fit_render_block_size(floats_per_frame), max_num_frames));
 }
 
-void nam::wavenet::WaveNet::_set_num_frames_(const long num_frames)
+long nam::wavenet::WaveNet::_get_receptive_field_() const
 {
-  if (num_frames == this->_num_frames)
+  // Each layer array feeds the next.
+  long receptive_field = 1;
+  for (const auto& layer_array : this->_layer_arrays)
+    receptive_field += layer_array.get_receptive_field();
+  return receptive_field;
+}
+
+void nam::wavenet::WaveNet::_prepare_(const int max_num_frames)
+{
+  // These check that it fits before anything changes, and reserve scratch for int8 and low-rank copies even if the
+  // buffers below are already big enough.
+  for (size_t i = 0; i < this->_layer_arrays.size(); i++)
+    this->_layer_arrays[i].set_max_num_frames_(max_num_frames);
+  // this->_head.set_max_num_frames_(max_num_frames);
+  if (max_num_frames <= this->_max_num_frames)
     return;
 
-  this->_condition.resize(this->_get_condition_dim(), num_frames);
+  this->_condition.resize(this->_get_condition_dim(), max_num_frames);
   for (size_t i = 0; i < this->_head_arrays.size(); i++)
-    this->_head_arrays[i].resize(this->_head_arrays[i].rows(), num_frames);
+    this->_head_arrays[i].resize(this->_head_arrays[i].rows(), max_num_frames);
   for (size_t i = 0; i < this->_layer_array_outputs.size(); i++)
-    this->_layer_array_outputs[i].resize(this->_layer_array_outputs[i].rows(), num_frames);
-  this->_head_output.resize(this->_head_output.rows(), num_frames);
+    this->_layer_array_outputs[i].resize(this->_layer_array_outputs[i].rows(), max_num_frames);
+  this->_head_output.resize(this->_head_output.rows(), max_num_frames);
   this->_head_output.setZero();
-
-  for (size_t i = 0; i < this->_layer_arrays.size(); i++)
-    this->_layer_arrays[i].set_num_frames_(num_frames);
-  // this->_head.set_num_frames_(num_frames);
-  this->_num_frames = num_frames;
+  this->_max_num_frames = max_num_frames;
 }
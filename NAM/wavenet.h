@@ -30,15 +30,30 @@ public:
   , _1x1(channels, channels, true)
   , _activation(activations::Activation::get_activation(activation))
   , _gated(gated){};
-  void set_weights_(std::vector<float>::iterator& weights);
+  void set_weights_(weights_it& weights);
   // :param `input`: from previous layer
   // :param `output`: to next layer
-  void process_(const Eigen::MatrixXf& input, const Eigen::MatrixXf& condition, Eigen::MatrixXf& head_input,
-                Eigen::MatrixXf& output, const long i_start, const long j_start);
-  void set_num_frames_(const long num_frames);
+  void process_(const Eigen::MatrixXf& input, const Eigen::Ref<const Eigen::MatrixXf>& condition,
+                Eigen::Ref<Eigen::MatrixXf> head_input, Eigen::Ref<Eigen::MatrixXf> output, const long i_start,
+                const long j_start);
+  // Make room to process up to `max_num_frames` frames at a time
+  void set_max_num_frames_(const long max_num_frames);
+  void pack_(WeightArena& arena);
+  void quantize_int8_();
+  int sparsify_(const float threshold);
+  void factorize_low_rank_(const float max_error, const std::string& name, std::vector<LowRankReport>& report);
+  // Keep only the given residual channels (in and out) and channels of _z
+  void select_channels_(const prune::Channels& residual, const prune::Channels& z);
   long get_channels() const { return this->_conv.get_in_channels(); };
+  // Channels of _z once gated. The same as get_channels() unless pruned.
+  long get_z_channels() const { return this->_1x1.get_in_channels(); };
   int get_dilation() const { return this->_conv.get_dilation(); };
   long get_kernel_size() const { return this->_conv.get_kernel_size(); };
+  const Conv1D& get_conv() const { return this->_conv; };
+  const Conv1x1& get_input_mixin() const { return this->_input_mixin; };
+  const Conv1x1& get_1x1() const { return this->_1x1; };
+  activations::Activation* get_activation() const { return this->_activation; };
+  bool is_gated() const { return this->_gated; };
 
 private:
   // The dilated convolution at the front of the block
@@ -47,8 +62,10 @@ private:
   Conv1x1 _input_mixin;
   // The post-activation 1x1 convolution
   Conv1x1 _1x1;
-  // The internal state
+  // The internal state. Has room for the most frames we've been asked for; process_() uses the leftmost columns.
   Eigen::MatrixXf _z;
+  // What _input_mixin adds to it
+  Eigen::MatrixXf _mixin;
 
   activations::Activation* _activation;
   const bool _gated;
@@ -100,19 +117,34 @@ public:
   //
   void prepare_for_frames_(const long num_frames);
 
-  // All arrays are "short".
-  void process_(const Eigen::MatrixXf& layer_inputs, // Short
-                const Eigen::MatrixXf& condition, // Short
-                Eigen::MatrixXf& layer_outputs, // Short
-                Eigen::MatrixXf& head_inputs, // Sum up on this.
-                Eigen::MatrixXf& head_outputs // post head-rechannel
+  // All arrays are "short". `condition` is done being read by the time `head_outputs` is written, so they may
+  // share memory.
+  void process_(const Eigen::Ref<const Eigen::MatrixXf>& layer_inputs, // Short
+                const Eigen::Ref<const Eigen::MatrixXf>& condition, // Short
+                Eigen::Ref<Eigen::MatrixXf> head_inputs, // Sum up on this.
+                Eigen::Ref<Eigen::MatrixXf> layer_outputs, // Short
+                Eigen::Ref<Eigen::MatrixXf> head_outputs // post head-rechannel
   );
-  void set_num_frames_(const long num_frames);
-  void set_weights_(std::vector<float>::iterator& it);
+  // Make room to process up to `max_num_frames` frames at a time. Throws if that doesn't fit in the layer buffers.
+  void set_max_num_frames_(const long max_num_frames);
+  void set_weights_(weights_it& it);
+  void pack_(WeightArena& arena);
+  void quantize_int8_();
+  int sparsify_(const float threshold);
+  void factorize_low_rank_(const float max_error, const std::string& name, std::vector<LowRankReport>& report);
+  // Keep only the given channels of the input, of the residual stream between the layers, of the layers' _z (and the
+  // head input) and of the head output. Layer buffers keep their contents.
+  void select_channels_(const prune::Channels& input, const prune::Channels& residual, const prune::Channels& z,
+                        const prune::Channels& head_output);
+  const Conv1x1& get_rechannel() const { return this->_rechannel; };
+  const std::vector<_Layer>& get_layers() const { return this->_layers; };
+  const Conv1x1& get_head_rechannel() const { return this->_head_rechannel; };
 
   // "Zero-indexed" receptive field.
   // E.g. a 1x1 convolution has a z.i.r.f. of zero.
   long get_receptive_field() const;
+  // The most frames set_max_num_frames_() accepts
+  long get_max_num_frames() const;
 
 private:
   long _buffer_start;
@@ -144,11 +176,11 @@ class _Head
 {
 public:
   _Head(const int input_size, const int num_layers, const int channels, const std::string activation);
-  void set_weights_(std::vector<float>::iterator& weights);
+  void set_weights_(weights_it& weights);
   // NOTE: the head transforms the provided input by applying a nonlinearity
   // to it in-place!
   void process_(Eigen::MatrixXf& inputs, Eigen::MatrixXf& outputs);
-  void set_num_frames_(const long num_frames);
+  void set_max_num_frames_(const long max_num_frames);
 
 private:
   int _channels;
@@ -169,14 +201,26 @@ class WaveNet : public DSP
 {
 public:
   WaveNet(const std::vector<LayerArrayParams>& layer_array_params, const float head_scale, const bool with_head,
-          std::vector<float> weights, const double expected_sample_rate = -1.0);
+          std::span<const float> weights, const double expected_sample_rate = -1.0);
   ~WaveNet() = default;
 
   void finalize_(const int num_frames) override;
-  void set_weights_(std::vector<float>& weights);
+  void set_weights_(std::span<const float> weights);
+
+protected:
+  void _process_(const float* input, float* output, const int num_frames) override;
+  void _pack_weights_(WeightArena& arena) override;
+  void _quantize_int8_() override;
+  int _sparsify_(const float threshold) override;
+  void _factorize_low_rank_(const float max_error, std::vector<LowRankReport>& report) override;
+  void _prune_channels_(const float tolerance, std::vector<PrunedChannels>& report) override;
+  void _prepare_(const int max_num_frames) override;
+  int _get_render_block_size_() const override;
+  long _get_receptive_field_() const override;
 
 private:
-  long _num_frames;
+  // The most frames the buffers below have room for. Each buffer uses its leftmost columns.
+  long _max_num_frames;
   std::vector<_LayerArray> _layer_arrays;
   // Their outputs
   std::vector<Eigen::MatrixXf> _layer_array_outputs;
@@ -191,13 +235,11 @@ private:
 
   void _advance_buffers_(const int num_frames);
   void _prepare_for_frames_(const long num_frames);
-  void process(NAM_SAMPLE* input, NAM_SAMPLE* output, const int num_frames) override;
 
   virtual int _get_condition_dim() const { return 1; };
-  // Fill in the "condition" array that's fed into the various parts of the net.
-  virtual void _set_condition_array(NAM_SAMPLE* input, const int num_frames);
-  // Ensure that all buffer arrays are the right size for this num_frames
-  void _set_num_frames_(const long num_frames);
+  // The "condition" array that's fed into the various parts of the net. By default that's the input itself; models
+  // that condition on more than that fill in _condition and return it.
+  virtual Eigen::Ref<const Eigen::MatrixXf> _get_condition(const float* input, const int num_frames);
 };
 }; // namespace wavenet
 }; // namespace nam
@@ -0,0 +1,96 @@
+#include <algorithm>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+
+#include "shared_weights.h"
+#include "weight_arena.h"
+
+void nam::WeightArena::Deleter::operator()(float* data) const
+{
+  ::operator delete(data, std::align_val_t(kAlignment));
+}
+
+nam::WeightArena::WeightArena(std::shared_ptr<const SharedWeights> shared)
+: _shared(std::move(shared))
+{
+  if (this->_shared == nullptr)
+    throw std::runtime_error("No shared weights given");
+  this->_format = this->_shared->get_format();
+}
+
+float* nam::WeightArena::take(const long rows, const long cols)
+{
+  if (this->is_shared())
+    throw std::runtime_error("Can't write to shared weights");
+  const long offset = this->_next((size_t)(padded_rows(rows) * cols));
+  return offset < 0 ? nullptr : this->_data.get() + offset;
+}
+
+const float* nam::WeightArena::take_shared(const long rows, const long cols)
+{
+  const long offset = this->_next((size_t)(padded_rows(rows) * cols));
+  return offset < 0 ? nullptr : this->_shared->data() + offset;
+}
+
+uint16_t* nam::WeightArena::take_half(const long rows, const long cols)
+{
+  if (this->is_shared())
+    throw std::runtime_error("Can't write to shared weights");
+  const long offset = this->_next(half_size(rows, cols));
+  return offset < 0 ? nullptr : reinterpret_cast<uint16_t*>(this->_data.get() + offset);
+}
+
+const uint16_t* nam::WeightArena::take_shared_half(const long rows, const long cols)
+{
+  const long offset = this->_next(half_size(rows, cols));
+  return offset < 0 ? nullptr : reinterpret_cast<const uint16_t*>(this->_shared->data() + offset);
+}
+
+size_t nam::WeightArena::half_size(const long rows, const long cols)
+{
+  // In floats, rounded up so that whatever comes next stays aligned
+  const size_t halves = (size_t)(padded_rows_half(rows) * cols);
+  return (halves / 2 + kPadding - 1) / kPadding * kPadding;
+}
+
+long nam::WeightArena::_next(const size_t n)
+{
+  if (!this->is_allocated())
+  {
+    this->_size += n;
+    return -1;
+  }
+  if (this->_used + n > this->_size)
+    throw std::runtime_error("Weight arena overflow: packing asked for more than was measured");
+  const size_t offset = this->_used;
+  this->_used += n;
+  return (long)offset;
+}
+
+void nam::WeightArena::allocate()
+{
+  this->_used = 0;
+  this->_allocated = true;
+  if (this->is_shared())
+  {
+    this->_matches = this->_shared->get_size() == this->_size;
+    this->_verifying = true;
+    return;
+  }
+  // Don't hand out a null arena for models without weights
+  const size_t bytes = std::max(this->_size, (size_t)1) * sizeof(float);
+  this->_data.reset(static_cast<float*>(::operator new(bytes, std::align_val_t(kAlignment))));
+  std::memset(this->_data.get(), 0, bytes);
+}
+
+void nam::WeightArena::finish_verifying()
+{
+  this->_used = 0;
+  this->_verifying = false;
+}
+
+const float* nam::WeightArena::data() const
+{
+  return this->is_shared() ? this->_shared->data() : this->_data.get();
+}
@@ -0,0 +1,313 @@
+#pragma once
+// Packed model weights
+//
+// Modules are built from the flat weight array one matrix at a time, so their coefficients end up scattered over many
+// small heap allocations with whatever alignment the allocator gives. Once a model is complete, DSP::pack_weights()
+// moves all of them into a single WeightArena:
+// * One contiguous, 64-byte-aligned allocation per model, laid out in the order the modules use them.
+// * Every matrix column (the unit Eigen's matrix-vector and matrix-matrix kernels stream over) starts on a 64-byte
+//   boundary, because the leading dimension is padded up to a multiple of kPadding floats. The padding is zeros.
+//   PackedWeights::for_each_panel_() maps packed matrices as Aligned64, so Eigen knows it can use aligned loads.
+//
+// Packing happens in passes over the same modules: the first only measures, the second copies. Modules just call
+// PackedWeights::pack_() on each of their weights every time, in the same order.
+//
+// An arena can also be backed by read-only memory that someone else owns and that already holds the packed weights
+// (see shared_weights.h). Then, after measuring, one pass checks that the memory holds the same weights as the model
+// and, if it does, another switches the model over to it.
+//
+// Arenas can store the big matrices in half precision (see half_precision.h). Modules say which weights may be stored
+// that way when they pack them; everything else stays float32.
+
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <type_traits>
+
+#include <Eigen/Dense>
+
+#include "half_precision.h"
+
+namespace nam
+{
+class SharedWeights;
+
+class WeightArena
+{
+public:
+  // Alignment of the arena and of every column in it, in bytes
+  static constexpr size_t kAlignment = 64;
+  // Leading dimensions are rounded up to a multiple of this many floats
+  static constexpr long kPadding = kAlignment / sizeof(float);
+  static long padded_rows(const long rows) { return (rows + kPadding - 1) / kPadding * kPadding; };
+  // Matrices stored in half precision are only converted, never handed to Eigen, so their columns just need to be
+  // whole 16-byte vectors. The matrix as a whole still takes up whole multiples of kAlignment.
+  static constexpr long kPaddingHalf = 8;
+  static long padded_rows_half(const long rows) { return (rows + kPaddingHalf - 1) / kPaddingHalf * kPaddingHalf; };
+
+  // An arena with memory of its own
+  WeightArena(const WeightFormat format = WeightFormat::kFloat32)
+  : _format(format) {};
+  // An arena over `shared`, which must hold weights packed from an identical model. Takes on their format.
+  WeightArena(std::shared_ptr<const SharedWeights> shared);
+
+  // Space for a (rows, cols) column-major matrix with leading dimension padded_rows(rows).
+  // Returns nullptr while measuring.
+  float* take(const long rows, const long cols);
+  // Shared arenas: where the (rows, cols) matrix already is. Returns nullptr while measuring.
+  const float* take_shared(const long rows, const long cols);
+  // The same for matrices stored in half precision, with leading dimension padded_rows_half(rows)
+  uint16_t* take_half(const long rows, const long cols);
+  const uint16_t* take_shared_half(const long rows, const long cols);
+  // What the matrices that may be stored in half precision are stored as
+  WeightFormat get_format() const { return this->_format; };
+  // Done measuring: allocate the (zeroed) arena, or check that the shared memory is the right size. Either way,
+  // rewind so the next pass hands out memory. Shared memory of the wrong size doesn't match; don't go on to check it.
+  void allocate();
+  // Shared arenas: done checking the weights; rewind so the next pass switches over to them.
+  void finish_verifying();
+  bool is_allocated() const { return this->_allocated; };
+  bool is_shared() const { return this->_shared != nullptr; };
+  // Shared arenas: whether this pass is the one that checks the weights
+  bool is_verifying() const { return this->_verifying; };
+  // Shared arenas: a weight was found not to match while checking
+  void mismatch_() { this->_matches = false; };
+  // Shared arenas: whether the shared memory has held the model's weights so far
+  bool matches() const { return this->_matches; };
+  // The packed weights
+  const float* data() const;
+  // In floats, including padding
+  size_t get_size() const { return this->_size; };
+
+private:
+  struct Deleter
+  {
+    void operator()(float* data) const;
+  };
+  std::unique_ptr<float, Deleter> _data;
+  std::shared_ptr<const SharedWeights> _shared;
+  WeightFormat _format = WeightFormat::kFloat32;
+  bool _allocated = false;
+  bool _verifying = false;
+  bool _matches = true;
+  size_t _size = 0;
+  // Next free float
+  size_t _used = 0;
+
+  // Offset of the next n floats, or -1 while measuring
+  long _next(const size_t n);
+  // How many floats a (rows, cols) matrix of halves takes up
+  static size_t half_size(const long rows, const long cols);
+};
+
+// A weight matrix (Cols=Eigen::Dynamic) or vector (Cols=1) that starts out owning its coefficients, and can then be
+// moved into a WeightArena.
+template <int Cols>
+class PackedWeights
+{
+public:
+  typedef Eigen::Matrix<float, Eigen::Dynamic, Cols> Matrix;
+  typedef Eigen::Map<const Matrix, 0, Eigen::OuterStride<>> View;
+  // Weights in an arena, or converted into an aligned buffer, which Eigen may use aligned loads on
+  typedef Eigen::Map<const Matrix, Eigen::Aligned64, Eigen::OuterStride<>> AlignedView;
+
+  void resize(const long rows, const long cols = Cols)
+  {
+    this->_owned.resize(rows, cols);
+    this->_packed = nullptr;
+    this->_packed_half = nullptr;
+  };
+  // For filling in the weights. Only valid until they're packed.
+  Matrix& get_() { return this->_owned; };
+  // What the kernels compute with. Only for weights stored as float32; see multiply_() and for_each_panel_().
+  View view() const
+  {
+    if (this->_packed != nullptr)
+      return View(this->_packed, this->_rows, this->_cols, Eigen::OuterStride<>(WeightArena::padded_rows(this->_rows)));
+    return View(this->_owned.data(), this->_owned.rows(), this->_owned.cols(),
+                Eigen::OuterStride<>(this->_owned.rows()));
+  };
+  // A float32 copy of the weights, however they're stored. Allocates, so not for the audio thread.
+  Matrix to_float() const
+  {
+    if (this->_packed_half == nullptr)
+      return this->view();
+    Matrix result(this->_rows, this->_cols);
+    const long ld = WeightArena::padded_rows_half(this->_rows);
+    for (long j = 0; j < this->_cols; j++)
+      half_precision::to_float(this->_packed_half + j * ld, this->_rows, this->_format, result.col(j).data());
+    return result;
+  };
+  // Call f(panel, row, col) with float32 views of the weights that together cover all of them, where (row, col) is
+  // the panel's top left corner. Weights stored as float32 are a single panel. Weights stored in half precision are
+  // converted a block of at most kPanelFloats at a time into a buffer on the stack, which stays in L1, so each weight
+  // is read from memory once, as 16 bits, and nothing is allocated. Panels are AlignedViews once the weights are
+  // packed, and Views before, so `f` must take either.
+  template <typename F>
+  void for_each_panel_(F&& f) const
+  {
+    if (this->_packed != nullptr)
+    {
+      const long ld = WeightArena::padded_rows(this->_rows);
+      f(AlignedView(this->_packed, this->_rows, this->_cols, Eigen::OuterStride<>(ld)), 0L, 0L);
+      return;
+    }
+    if (this->_packed_half == nullptr)
+    {
+      f(this->view(), 0L, 0L);
+      return;
+    }
+    alignas(WeightArena::kAlignment) float buffer[kPanelFloats];
+    const long ld = WeightArena::padded_rows_half(this->_rows);
+    const long panel_rows = std::min(this->_rows, kPanelFloats);
+    const long panel_cols = std::max(1L, kPanelFloats / std::max(1L, panel_rows));
+    for (long row = 0; row < this->_rows; row += panel_rows)
+    {
+      const long rows = std::min(panel_rows, this->_rows - row);
+      for (long col = 0; col < this->_cols; col += panel_cols)
+      {
+        const long cols = std::min(panel_cols, this->_cols - col);
+        for (long j = 0; j < cols; j++)
+          half_precision::to_float(this->_packed_half + (col + j) * ld + row, rows, this->_format, buffer + j * rows);
+        f(AlignedView(buffer, rows, cols, Eigen::OuterStride<>(rows)), row, col);
+      }
+    }
+  }
+  // output = weights * input, or output += weights * input if `accumulate`. Realtime-safe.
+  template <typename Input, typename Output>
+  void multiply_(const Input& input, Output&& output, const bool accumulate) const
+  {
+    if constexpr (std::decay_t<Output>::ColsAtCompileTime == 1)
+      if (this->_packed_half != nullptr)
+      {
+        // Each weight is only used once, so skip the buffer and add them up as they're converted.
+        if (!accumulate)
+          output.setZero();
+        const long ld = WeightArena::padded_rows_half(this->_rows);
+        half_precision::multiply(
+          this->_packed_half, this->_rows, this->_cols, ld, this->_format, input.data(), output.data());
+        return;
+      }
+    if (!accumulate && this->_packed_half != nullptr && this->_cols == 0)
+      output.setZero(); // No panels
+    this->for_each_panel_([&](const auto& panel, const long row, const long col) {
+      if (accumulate || col > 0)
+        output.middleRows(row, panel.rows()).noalias() += panel * input.middleRows(col, panel.cols());
+      else
+        output.middleRows(row, panel.rows()).noalias() = panel * input.middleRows(col, panel.cols());
+    });
+  }
+  long rows() const { return this->is_packed() ? this->_rows : this->_owned.rows(); };
+  long cols() const { return this->is_packed() ? this->_cols : this->_owned.cols(); };
+  long size() const { return this->rows() * this->cols(); };
+  bool is_packed() const { return this->_packed != nullptr || this->_packed_half != nullptr; };
+  WeightFormat get_format() const { return this->_format; };
+
+  // The most floats for_each_panel_() converts at once: 8kB
+  static constexpr long kPanelFloats = 2048;
+
+  // Move the weights into `arena`, wherever they are now. If `allow_half`, they're stored in the arena's format;
+  // otherwise as float32.
+  void pack_(WeightArena& arena, const bool allow_half = false)
+  {
+    const Matrix source = this->to_float();
+    if (allow_half && arena.get_format() != WeightFormat::kFloat32)
+      this->_pack_half_(arena, source);
+    else
+      this->_pack_float_(arena, source);
+  };
+
+private:
+  Matrix _owned;
+  // Where the weights are once packed, depending on the format. Owned by the model's arena.
+  const float* _packed = nullptr;
+  const uint16_t* _packed_half = nullptr;
+  WeightFormat _format = WeightFormat::kFloat32;
+  long _rows = 0;
+  long _cols = 0;
+
+  void _pack_float_(WeightArena& arena, const Matrix& source)
+  {
+    const long rows = source.rows();
+    const long cols = source.cols();
+    const long ld = WeightArena::padded_rows(rows);
+    if (arena.is_shared())
+    {
+      const float* data = arena.take_shared(rows, cols);
+      if (data == nullptr)
+        return; // Just measuring
+      if (arena.is_verifying())
+      {
+        for (long j = 0; j < cols && rows > 0 && arena.matches(); j++)
+          if (std::memcmp(data + j * ld, source.col(j).data(), rows * sizeof(float)) != 0)
+            arena.mismatch_();
+        return;
+      }
+      this->_point_at(data, rows, cols);
+      return;
+    }
+    float* data = arena.take(rows, cols);
+    if (data == nullptr)
+      return; // Just measuring
+    for (long j = 0; j < cols; j++)
+      for (long i = 0; i < rows; i++)
+        data[j * ld + i] = source(i, j);
+    this->_point_at(data, rows, cols);
+  };
+
+  void _pack_half_(WeightArena& arena, const Matrix& source)
+  {
+    const long rows = source.rows();
+    const long cols = source.cols();
+    const long ld = WeightArena::padded_rows_half(rows);
+    const WeightFormat format = arena.get_format();
+    if (arena.is_shared())
+    {
+      const uint16_t* data = arena.take_shared_half(rows, cols);
+      if (data == nullptr)
+        return; // Just measuring
+      if (arena.is_verifying())
+      {
+        for (long j = 0; j < cols && arena.matches(); j++)
+          for (long i = 0; i < rows; i++)
+            if (data[j * ld + i] != half_precision::from_float(source(i, j), format))
+              arena.mismatch_();
+        return;
+      }
+      this->_point_at_half(data, rows, cols, format);
+      return;
+    }
+    uint16_t* data = arena.take_half(rows, cols);
+    if (data == nullptr)
+      return; // Just measuring
+    for (long j = 0; j < cols; j++)
+      for (long i = 0; i < rows; i++)
+        data[j * ld + i] = half_precision::from_float(source(i, j), format);
+    this->_point_at_half(data, rows, cols, format);
+  };
+
+  void _point_at(const float* data, const long rows, const long cols)
+  {
+    this->_rows = rows;
+    this->_cols = cols;
+    this->_packed = data;
+    this->_packed_half = nullptr;
+    this->_format = WeightFormat::kFloat32;
+    this->_owned = Matrix();
+  };
+
+  void _point_at_half(const uint16_t* data, const long rows, const long cols, const WeightFormat format)
+  {
+    this->_rows = rows;
+    this->_cols = cols;
+    this->_packed = nullptr;
+    this->_packed_half = data;
+    this->_format = format;
+    this->_owned = Matrix();
+  };
+};
+
+typedef PackedWeights<Eigen::Dynamic> PackedMatrix;
+typedef PackedWeights<1> PackedVector;
+}; // namespace nam
@@ -0,0 +1,209 @@
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "NAM/activations.h"
+#include "NAM/dsp.h"
+
+using std::chrono::duration;
+using std::chrono::high_resolution_clock;
+
+// Number of points in the sweep used for the error report
+#define ERROR_SWEEP_POINTS 2000001
+// Range of the sweep. Pre-activations in trained models live well inside this.
+#define ERROR_SWEEP_MAX 10.0
+// Number of elements pushed through each activation per throughput measurement
+#define THROUGHPUT_ELEMENTS (1 << 24)
+// How long (in seconds) the end-to-end test signal is
+#define E2E_SECONDS 4
+#define AUDIO_BUFFER_SIZE 64
+
+constexpr double kPi = 3.14159265358979323846;
+
+namespace
+{
+struct ErrorStats
+{
+  double max_abs = 0.0;
+  double rms = 0.0;
+  double max_ulp = 0.0;
+};
+
+// Distance in units of least precision between two floats.
+double ulp_distance(const float a, const float b)
+{
+  if (a == b)
+    return 0.0;
+  int32_t ia, ib;
+  std::memcpy(&ia, &a, sizeof(float));
+  std::memcpy(&ib, &b, sizeof(float));
+  // Map the sign-magnitude representation onto a monotonic integer line.
+  const int64_t la = ia < 0 ? (int64_t)INT32_MIN - ia : ia;
+  const int64_t lb = ib < 0 ? (int64_t)INT32_MIN - ib : ib;
+  return (double)std::llabs(la - lb);
+}
+
+template <typename Approx, typename Exact>
+ErrorStats measure_error(Approx approx, Exact exact)
+{
+  ErrorStats stats;
+  double sum_sq = 0.0;
+  for (long i = 0; i < ERROR_SWEEP_POINTS; i++)
+  {
+    const float x = (float)(-ERROR_SWEEP_MAX + 2.0 * ERROR_SWEEP_MAX * i / (ERROR_SWEEP_POINTS - 1));
+    const double reference = exact((double)x);
+    const float y = approx(x);
+    const double err = std::abs((double)y - reference);
+    stats.max_abs = std::max(stats.max_abs, err);
+    stats.max_ulp = std::max(stats.max_ulp, ulp_distance(y, (float)reference));
+    sum_sq += err * err;
+  }
+  stats.rms = std::sqrt(sum_sq / ERROR_SWEEP_POINTS);
+  return stats;
+}
+
+// Elements per nanosecond when applying `activation` to a (width,) array over and over.
+double measure_throughput(nam::activations::Activation* activation, const long width)
+{
+  std::vector<float> data(width);
+  for (long i = 0; i < width; i++)
+    data[i] = (float)(-4.0 + 8.0 * i / std::max(width - 1, 1L));
+  const long repeats = std::max(THROUGHPUT_ELEMENTS / width, 1L);
+
+  // Activations are applied in place, so later repeats see the previous output. None of them drift into denormals
+  // or anything else that would change their cost.
+  auto t1 = high_resolution_clock::now();
+  for (long r = 0; r < repeats; r++)
+    activation->apply(data.data(), width);
+  auto t2 = high_resolution_clock::now();
+  // Keep the compiler from throwing the work away
+  volatile float sink = data[width / 2];
+  (void)sink;
+  duration<double, std::nano> elapsed = t2 - t1;
+  return (double)(repeats * width) / elapsed.count();
+}
+
+double exact_sigmoid(const double x)
+{
+  return 1.0 / (1.0 + std::exp(-x));
+}
+
+void print_error(const std::string& name, const ErrorStats& stats)
+{
+  std::cout << std::left << std::setw(24) << name << std::right << std::setw(14) << stats.max_abs << std::setw(14)
+            << stats.rms << std::setw(14) << stats.max_ulp << "\n";
+}
+
+// Run the model over a test signal and collect its output.
+std::vector<NAM_SAMPLE> render(nam::DSP& model, const std::vector<NAM_SAMPLE>& input)
+{
+  std::vector<NAM_SAMPLE> output(input.size());
+  for (size_t i = 0; i + AUDIO_BUFFER_SIZE <= input.size(); i += AUDIO_BUFFER_SIZE)
+  {
+    model.process(&input[i], &output[i], AUDIO_BUFFER_SIZE);
+    model.finalize_(AUDIO_BUFFER_SIZE);
+  }
+  return output;
+}
+
+// Something guitar-ish: a decaying chord with some harmonics plus a little noise, at a few levels.
+std::vector<NAM_SAMPLE> make_test_signal(const double sample_rate)
+{
+  const long num_samples = (long)(E2E_SECONDS * sample_rate) / AUDIO_BUFFER_SIZE * AUDIO_BUFFER_SIZE;
+  std::vector<NAM_SAMPLE> signal(num_samples);
+  const double freqs[] = {82.41, 123.47, 164.81, 207.65, 246.94};
+  uint32_t seed = 1;
+  for (long i = 0; i < num_samples; i++)
+  {
+    const double t = i / sample_rate;
+    const double note_t = std::fmod(t, 1.0);
+    const double level = 0.1 * (1 + (long)t % E2E_SECONDS);
+    double x = 0.0;
+    for (const double f : freqs)
+      x += std::sin(2.0 * kPi * f * t) + 0.3 * std::sin(4.0 * kPi * f * t);
+    seed = seed * 1664525u + 1013904223u;
+    const double noise = ((double)seed / 4294967296.0 - 0.5) * 0.01;
+    signal[i] = (NAM_SAMPLE)(level * std::exp(-3.0 * note_t) * x / 5.0 + noise);
+  }
+  return signal;
+}
+
+void report_end_to_end(const char* modelPath)
+{
+  std::cout << "\nEnd-to-end impact on " << modelPath << "\n";
+
+  // Activations are looked up when a model is built, so each setting needs its own instance.
+  nam::activations::Activation::disable_fast_tanh();
+  std::unique_ptr<nam::DSP> exactModel = nam::get_dsp(modelPath);
+  nam::activations::Activation::enable_fast_tanh();
+  std::unique_ptr<nam::DSP> fastModel = nam::get_dsp(modelPath);
+
+  const double sampleRate = exactModel->GetExpectedSampleRate() > 0.0 ? exactModel->GetExpectedSampleRate() : 48000.0;
+  const std::vector<NAM_SAMPLE> input = make_test_signal(sampleRate);
+
+  nam::activations::Activation::disable_fast_tanh();
+  const std::vector<NAM_SAMPLE> exactOutput = render(*exactModel, input);
+  nam::activations::Activation::enable_fast_tanh();
+  const std::vector<NAM_SAMPLE> fastOutput = render(*fastModel, input);
+  nam::activations::Activation::disable_fast_tanh();
+
+  double signalEnergy = 0.0;
+  double errorEnergy = 0.0;
+  double maxError = 0.0;
+  for (size_t i = 0; i < input.size(); i++)
+  {
+    const double err = (double)fastOutput[i] - (double)exactOutput[i];
+    signalEnergy += (double)exactOutput[i] * (double)exactOutput[i];
+    errorEnergy += err * err;
+    maxError = std::max(maxError, std::abs(err));
+  }
+  const double esr = signalEnergy > 0.0 ? errorEnergy / signalEnergy : 0.0;
+  std::cout << "  Fasttanh vs Tanh: ESR " << esr << " (" << 10.0 * std::log10(std::max(esr, 1e-30))
+            << " dB), max abs error " << maxError << " over " << input.size() << " samples\n";
+}
+}; // namespace
+
+int main(int argc, char* argv[])
+{
+  std::cout << std::setprecision(4);
+
+  std::cout << "Error over [" << -ERROR_SWEEP_MAX << ", " << ERROR_SWEEP_MAX
+            << "] against double-precision reference\n";
+  std::cout << std::left << std::setw(24) << "Function" << std::right << std::setw(14) << "max abs" << std::setw(14)
+            << "RMS" << std::setw(14) << "max ULP" << "\n";
+  auto exact_tanh = [](const double x) { return std::tanh(x); };
+  print_error("tanh (std::tanh)", measure_error([](const float x) { return std::tanh(x); }, exact_tanh));
+  print_error("fast_tanh", measure_error(nam::activations::fast_tanh, exact_tanh));
+  print_error("sigmoid", measure_error(nam::activations::sigmoid, exact_sigmoid));
+  print_error("fast_sigmoid", measure_error(nam::activations::fast_sigmoid, exact_sigmoid));
+
+  std::cout << "\nThroughput (elements/ns) by array width\n";
+  const long widths[] = {8, 16, 64, 256, 1024, 16384};
+  const char* names[] = {"Tanh", "Fasttanh", "Hardtanh", "ReLU", "Sigmoid"};
+  // Make sure "Tanh" means std::tanh here.
+  nam::activations::Activation::disable_fast_tanh();
+  std::cout << std::left << std::setw(12) << "Activation" << std::right;
+  for (const long width : widths)
+    std::cout << std::setw(10) << width;
+  std::cout << "\n";
+  for (const char* name : names)
+  {
+    nam::activations::Activation* activation = nam::activations::Activation::get_activation(name);
+    std::cout << std::left << std::setw(12) << name << std::right;
+    for (const long width : widths)
+      std::cout << std::setw(10) << measure_throughput(activation, width);
+    std::cout << "\n";
+  }
+
+  if (argc > 1)
+    report_end_to_end(argv[1]);
+  else
+    std::cout << "\nPass a model path to also report the end-to-end error: benchactivations <model_path>\n";
+
+  exit(0);
+}
@@ -1,8 +1,18 @@
 #include "malloc.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <string>
 #include <chrono>
+#include <vector>
 
 #include "NAM/dsp.h"
+#include "NAM/parallel_render.h"
+#include "NAM/rebuffering.h"
+#include "NAM/render_engine.h"
+#include "NAM/resampling.h"
 
 using std::chrono::duration;
 using std::chrono::duration_cast;
@@ -13,12 +23,194 @@ using std::chrono::milliseconds;
 
 double buffer[AUDIO_BUFFER_SIZE];
 
-int main(int argc, char* argv[])
+// Run `model` over `input` a buffer at a time
+std::vector<NAM_SAMPLE> render(nam::DSP& model, const std::vector<NAM_SAMPLE>& input)
+{
+  std::vector<NAM_SAMPLE> output(input.size());
+  for (size_t i = 0; i + AUDIO_BUFFER_SIZE <= input.size(); i += AUDIO_BUFFER_SIZE)
+  {
+    model.process(input.data() + i, output.data() + i, AUDIO_BUFFER_SIZE);
+    model.finalize_(AUDIO_BUFFER_SIZE);
+  }
+  return output;
+}
+
+// Reduced-precision options, and what they do to a model
+struct Precision
+{
+  const char* flag;
+  const char* name;
+  void (*apply)(nam::DSP& model);
+};
+
+const Precision precisions[] = {
+  {"--int8", "Int8", [](nam::DSP& model) { model.quantize_int8(); }},
+  {"--fp16", "Float16", [](nam::DSP& model) { model.pack_weights(nam::WeightFormat::kFloat16); }},
+  {"--bf16", "BFloat16", [](nam::DSP& model) { model.pack_weights(nam::WeightFormat::kBFloat16); }},
+};
+
+// Error-to-signal ratio of `actual` against `reference` on a two-second test signal
+double esr(nam::DSP& reference, nam::DSP& actual)
+{
+  // Exponential sine sweep from 20Hz to 20kHz at -6dBFS
+  const size_t num_samples = 96000;
+  const double sample_rate = 48000.0;
+  const double duration = num_samples / sample_rate;
+  const double k = std::log(20000.0 / 20.0);
+  std::vector<NAM_SAMPLE> input(num_samples);
+  for (size_t i = 0; i < num_samples; i++)
+  {
+    const double t = i / sample_rate;
+    input[i] = (NAM_SAMPLE)(0.5 * std::sin(2.0 * M_PI * 20.0 * duration / k * (std::exp(t / duration * k) - 1.0)));
+  }
+
+  const std::vector<NAM_SAMPLE> expected = render(reference, input);
+  const std::vector<NAM_SAMPLE> output = render(actual, input);
+  double error = 0.0, signal = 0.0;
+  for (size_t i = 0; i < num_samples; i++)
+  {
+    error += (output[i] - expected[i]) * (output[i] - expected[i]);
+    signal += expected[i] * expected[i];
+  }
+  return signal > 0.0 ? error / signal : 0.0;
+}
+
+// Error-to-signal ratio of the reduced-precision model against the float one
+double precision_esr(const char* modelPath, const Precision& precision)
+{
+  std::unique_ptr<nam::DSP> reference = nam::get_dsp(modelPath);
+  std::unique_ptr<nam::DSP> reduced = nam::get_dsp(modelPath);
+  precision.apply(*reduced);
+  return esr(*reference, *reduced);
+}
+
+// Milliseconds `model` takes to process two seconds of audio at 48kHz, `block_size` frames at a time
+double time_model(nam::DSP& model, const int block_size = AUDIO_BUFFER_SIZE)
+{
+  std::vector<double> audio(block_size, 0.0);
+  const size_t numBuffers = (48000 * 2) / block_size;
+  auto t1 = high_resolution_clock::now();
+  for (size_t i = 0; i < numBuffers; i++)
+  {
+    model.process(audio.data(), audio.data(), block_size);
+    model.finalize_(block_size);
+  }
+  auto t2 = high_resolution_clock::now();
+  return duration<double, std::milli>(t2 - t1).count();
+}
+
+// Time `before` and `after` alternately: once each to warm up, then the better of three
+void compare_speed(nam::DSP& before, const char* before_name, nam::DSP& after, const char* after_name,
+                   const int block_size = AUDIO_BUFFER_SIZE)
+{
+  time_model(before, block_size);
+  time_model(after, block_size);
+  double before_ms = 1e30, after_ms = 1e30;
+  for (int i = 0; i < 3; i++)
+  {
+    before_ms = std::min(before_ms, time_model(before, block_size));
+    after_ms = std::min(after_ms, time_model(after, block_size));
+  }
+  std::cout << before_name << ": " << before_ms << "ms, " << after_name << ": " << after_ms
+            << "ms, speedup: " << before_ms / after_ms << "x\n";
+}
+
+// All of benchmodel's options. Each one is a different benchmark, so at most one is given.
+struct Options
+{
+  const char* model_path = nullptr;
+  const Precision* precision = nullptr;
+  bool sparse = false;
+  bool render = false;
+  float low_rank_error = -1.0f;
+  float prune_tolerance = -1.0f;
+  double host_sample_rate = -1.0;
+  int host_block_size = -1;
+  int engine_models = 0;
+  int parallel_threads = -1;
+};
+
+void usage()
+{
+  std::cerr << "Usage: benchmodel [--int8|--fp16|--bf16|--sparse|--low-rank <max_error>|--prune <tolerance>|--render|"
+               "--resample <host_rate>|--rebuffer <host_block_size>|--engine <num_models>|"
+               "--parallel <num_threads>] <model_path>\n";
+}
+
+[[noreturn]] void bad_arguments(const std::string& message)
+{
+  std::cerr << message << "\n";
+  usage();
+  exit(1);
+}
+
+// The value after option `flag`, as a number that's at least `min`
+double parse_value(const char* flag, const char* value, const double min, const bool integer)
+{
+  char* end = nullptr;
+  const double result = value != nullptr ? std::strtod(value, &end) : 0.0;
+  if (value == nullptr || *value == '\0' || *end != '\0' || result < min || (integer && result != std::floor(result)))
+    bad_arguments(std::string(flag) + " needs " + (integer ? "an integer" : "a number") + " of at least "
+                  + std::to_string((long)min));
+  return result;
+}
+
+Options parse_options(const int argc, char* argv[])
 {
-  if (argc > 1)
+  Options options;
+  const char* option = nullptr;
+  for (int i = 1; i < argc; i++)
   {
-    const char* modelPath = argv[1];
+    const char* arg = argv[i];
+    if (arg[0] != '-')
+    {
+      if (options.model_path != nullptr)
+        bad_arguments(std::string("More than one model: ") + options.model_path + " and " + arg);
+      options.model_path = arg;
+      continue;
+    }
+    if (option != nullptr)
+      bad_arguments(std::string("Only one option at a time: ") + option + " and " + arg);
+    option = arg;
+    const Precision* precision = nullptr;
+    for (const Precision& p : precisions)
+      if (std::strcmp(arg, p.flag) == 0)
+        precision = &p;
+    // Every option but these takes a value.
+    const bool takes_value =
+      precision == nullptr && std::strcmp(arg, "--sparse") != 0 && std::strcmp(arg, "--render") != 0;
+    const char* value = takes_value && i + 1 < argc ? argv[++i] : nullptr;
+
+    if (precision != nullptr)
+      options.precision = precision;
+    else if (std::strcmp(arg, "--sparse") == 0)
+      options.sparse = true;
+    else if (std::strcmp(arg, "--render") == 0)
+      options.render = true;
+    else if (std::strcmp(arg, "--low-rank") == 0)
+      options.low_rank_error = (float)parse_value(arg, value, 0.0, false);
+    else if (std::strcmp(arg, "--prune") == 0)
+      options.prune_tolerance = (float)parse_value(arg, value, 0.0, false);
+    else if (std::strcmp(arg, "--resample") == 0)
+      options.host_sample_rate = parse_value(arg, value, 1.0, false);
+    else if (std::strcmp(arg, "--rebuffer") == 0)
+      options.host_block_size = (int)parse_value(arg, value, 1.0, true);
+    else if (std::strcmp(arg, "--engine") == 0)
+      options.engine_models = (int)parse_value(arg, value, 1.0, true);
+    else if (std::strcmp(arg, "--parallel") == 0)
+      options.parallel_threads = (int)parse_value(arg, value, 0.0, true);
+    else
+      bad_arguments(std::string("Unknown option: ") + arg);
+  }
+  return options;
+}
 
+int main(int argc, char* argv[])
+{
+  const Options options = parse_options(argc, argv);
+  const char* modelPath = options.model_path;
+  if (modelPath != nullptr)
+  {
     std::cout << "Loading model " << modelPath << "\n";
 
     // Turn on fast tanh approximation
@@ -36,6 +228,222 @@ int main(int argc, char* argv[])
       exit(1);
     }
 
+    if (options.precision != nullptr)
+    {
+      const double esr = precision_esr(modelPath, *options.precision);
+      std::cout << options.precision->name << " ESR vs float: " << esr << " (" << 10.0 * std::log10(esr + 1e-30)
+                << " dB)\n";
+      options.precision->apply(*model);
+    }
+
+    if (options.sparse)
+    {
+      // get_dsp() already made `model` sparse where it could; compare it against a copy that's dense everywhere.
+      std::unique_ptr<nam::DSP> dense = nam::get_dsp(modelPath);
+      dense->sparsify(2.0f);
+      const int num_sparse = model->sparsify(nam::get_sparsity_threshold());
+      std::cout << num_sparse << " sparse matrices at threshold " << nam::get_sparsity_threshold() << "\n";
+      {
+        // Only the order of the sums changes, so this should be tiny
+        std::unique_ptr<nam::DSP> actual = nam::get_dsp(modelPath);
+        const double sparse_esr = esr(*dense, *actual);
+        std::cout << "Sparse ESR vs dense: " << sparse_esr << " (" << 10.0 * std::log10(sparse_esr + 1e-30) << " dB)\n";
+      }
+      compare_speed(*dense, "Dense", *model, "sparse");
+      exit(0);
+    }
+
+    if (options.low_rank_error >= 0.0f)
+    {
+      std::unique_ptr<nam::DSP> original = nam::get_dsp(modelPath);
+      long dense_macs = 0, factored_macs = 0;
+      for (const nam::LowRankReport& r : model->factorize_low_rank(options.low_rank_error))
+      {
+        std::cout << r.name << " (" << r.rows << "x" << r.cols << "): rank " << r.rank << ", error " << r.error
+                  << (r.factored ? "" : " (kept dense)") << "\n";
+        dense_macs += r.rows * r.cols;
+        factored_macs += r.factored ? r.rank * (r.rows + r.cols) : r.rows * r.cols;
+      }
+      std::cout << "Multiply-adds per frame in these matrices: " << dense_macs << " -> " << factored_macs << "\n";
+      {
+        std::unique_ptr<nam::DSP> reference = nam::get_dsp(modelPath);
+        std::unique_ptr<nam::DSP> actual = nam::get_dsp(modelPath);
+        actual->factorize_low_rank(options.low_rank_error);
+        const double low_rank_esr = esr(*reference, *actual);
+        std::cout << "Low-rank ESR vs original: " << low_rank_esr << " (" << 10.0 * std::log10(low_rank_esr + 1e-30)
+                  << " dB)\n";
+      }
+      compare_speed(*original, "Original", *model, "low-rank");
+      exit(0);
+    }
+
+    if (options.prune_tolerance >= 0.0f)
+    {
+      std::unique_ptr<nam::DSP> original = nam::get_dsp(modelPath);
+      const size_t packed_before = model->get_packed_weights().size();
+      for (const nam::PrunedChannels& p : model->prune_channels(options.prune_tolerance))
+        std::cout << p.name << ": " << p.before << " -> " << p.after << " channels\n";
+      std::cout << "Packed weights: " << packed_before << " -> " << model->get_packed_weights().size() << "\n";
+      {
+        std::unique_ptr<nam::DSP> reference = nam::get_dsp(modelPath);
+        std::unique_ptr<nam::DSP> actual = nam::get_dsp(modelPath);
+        actual->prune_channels(options.prune_tolerance);
+        const double prune_esr = esr(*reference, *actual);
+        std::cout << "Pruned ESR vs original: " << prune_esr << " (" << 10.0 * std::log10(prune_esr + 1e-30)
+                  << " dB)\n";
+      }
+      compare_speed(*original, "Original", *model, "pruned");
+      exit(0);
+    }
+
+    if (options.host_sample_rate > 0.0)
+    {
+      // The same amount of host audio either way: the model run at the host's rate, or at its own inside the wrapper
+      std::unique_ptr<nam::DSP> native = nam::get_dsp(modelPath);
+      nam::ResamplingDSP resampled(std::move(model), options.host_sample_rate);
+      std::cout << "Model rate: " << resampled.get_model().GetExpectedSampleRate() << "Hz, host rate: "
+                << options.host_sample_rate << "Hz, added latency: " << resampled.get_latency() << " samples\n";
+      compare_speed(*native, "At host rate", resampled, "resampled");
+      exit(0);
+    }
+
+    if (options.render)
+    {
+      // Ten seconds of noise, a host-sized buffer at a time and then all at once
+      std::vector<float> input(48000 * 10), output(input.size());
+      for (float& x : input)
+        x = 0.2f * ((float)std::rand() / RAND_MAX - 0.5f);
+      std::unique_ptr<nam::DSP> realtime = nam::get_dsp(modelPath);
+      realtime->prepare(AUDIO_BUFFER_SIZE);
+      auto t1 = high_resolution_clock::now();
+      for (size_t i = 0; i + AUDIO_BUFFER_SIZE <= input.size(); i += AUDIO_BUFFER_SIZE)
+      {
+        realtime->process(input.data() + i, output.data() + i, AUDIO_BUFFER_SIZE);
+        realtime->finalize_(AUDIO_BUFFER_SIZE);
+      }
+      auto t2 = high_resolution_clock::now();
+      model->render(input.data(), output.data(), input.size());
+      auto t3 = high_resolution_clock::now();
+      const double realtime_ms = duration<double, std::milli>(t2 - t1).count();
+      const double render_ms = duration<double, std::milli>(t3 - t2).count();
+      std::cout << "Render block size: " << model->get_render_block_size() << "\n";
+      std::cout << AUDIO_BUFFER_SIZE << "-frame buffers: " << realtime_ms << "ms, render(): " << render_ms
+                << "ms, speedup: " << realtime_ms / render_ms << "x\n";
+      exit(0);
+    }
+
+    if (options.engine_models > 0)
+    {
+      // Two seconds of a tick for each copy of the model, one after another on this thread and then in an engine
+      const size_t num_ticks = (48000 * 2) / AUDIO_BUFFER_SIZE;
+      std::vector<std::unique_ptr<nam::DSP>> serial;
+      nam::RenderEngine engine;
+      for (int i = 0; i < options.engine_models; i++)
+      {
+        serial.push_back(nam::get_dsp(modelPath));
+        serial.back()->prepare(AUDIO_BUFFER_SIZE);
+        engine.add(nam::get_dsp(modelPath));
+      }
+      engine.prepare(AUDIO_BUFFER_SIZE);
+      std::vector<std::vector<float>> audio(options.engine_models, std::vector<float>(AUDIO_BUFFER_SIZE));
+      std::vector<std::vector<float>> expected(options.engine_models, std::vector<float>(AUDIO_BUFFER_SIZE));
+      std::vector<const float*> inputs(options.engine_models);
+      std::vector<float*> outputs(options.engine_models);
+      for (int i = 0; i < options.engine_models; i++)
+        inputs[i] = outputs[i] = audio[i].data();
+      float max_difference = 0.0f;
+      double serial_ms = 0.0, engine_ms = 0.0;
+      for (size_t tick = 0; tick < num_ticks; tick++)
+      {
+        for (int i = 0; i < options.engine_models; i++)
+          for (int j = 0; j < AUDIO_BUFFER_SIZE; j++)
+            audio[i][j] = expected[i][j] = 0.2f * ((float)std::rand() / RAND_MAX - 0.5f);
+        auto t1 = high_resolution_clock::now();
+        for (int i = 0; i < options.engine_models; i++)
+        {
+          serial[i]->process(expected[i].data(), expected[i].data(), AUDIO_BUFFER_SIZE);
+          serial[i]->finalize_(AUDIO_BUFFER_SIZE);
+        }
+        auto t2 = high_resolution_clock::now();
+        engine.process(inputs.data(), outputs.data(), AUDIO_BUFFER_SIZE);
+        auto t3 = high_resolution_clock::now();
+        serial_ms += duration<double, std::milli>(t2 - t1).count();
+        engine_ms += duration<double, std::milli>(t3 - t2).count();
+        for (int i = 0; i < options.engine_models; i++)
+          for (int j = 0; j < AUDIO_BUFFER_SIZE; j++)
+            max_difference = std::max(max_difference, std::abs(audio[i][j] - expected[i][j]));
+      }
+      std::cout << options.engine_models << " models on " << engine.get_num_threads()
+                << " threads, max difference from serial: " << max_difference << "\n";
+      std::cout << "Serial: " << serial_ms << "ms, engine: " << engine_ms << "ms, speedup: " << serial_ms / engine_ms
+                << "x\n";
+      exit(0);
+    }
+
+    if (options.parallel_threads >= 0)
+    {
+      // A minute of noise, rendered in one go and then in chunks
+      std::vector<float> input(48000 * 60), serial(input.size()), parallel(input.size());
+      for (float& x : input)
+        x = 0.2f * ((float)std::rand() / RAND_MAX - 0.5f);
+      const nam::ModelFactory make_model = [&]() { return nam::get_dsp(modelPath); };
+      auto t1 = high_resolution_clock::now();
+      model->render(input.data(), serial.data(), input.size());
+      auto t2 = high_resolution_clock::now();
+      const double serial_ms = duration<double, std::milli>(t2 - t1).count();
+      std::cout << "Serial: " << serial_ms << "ms\n";
+
+      if (model->get_receptive_field() <= 0)
+      {
+        // Not exact, so show how far off the seams are for a few warm-ups
+        for (const size_t warm_up_frames : {0, 256, 1024, 4096, 16384, 48000})
+        {
+          t1 = high_resolution_clock::now();
+          nam::render_parallel_with_warm_up(
+            make_model, input.data(), parallel.data(), input.size(), warm_up_frames, (size_t)options.parallel_threads);
+          t2 = high_resolution_clock::now();
+          double max_error = 0.0, error_energy = 0.0, signal_energy = 0.0;
+          for (size_t i = 0; i < input.size(); i++)
+          {
+            const double error = (double)parallel[i] - serial[i];
+            max_error = std::max(max_error, std::abs(error));
+            error_energy += error * error;
+            signal_energy += (double)serial[i] * serial[i];
+          }
+          const double seam_esr = error_energy / (signal_energy + 1e-30);
+          const double parallel_ms = duration<double, std::milli>(t2 - t1).count();
+          std::cout << "Warm-up " << warm_up_frames << ": max seam error " << max_error << ", ESR " << seam_esr << " ("
+                    << 10.0 * std::log10(seam_esr + 1e-30) << " dB), " << parallel_ms
+                    << "ms, speedup: " << serial_ms / parallel_ms << "x\n";
+        }
+        exit(0);
+      }
+
+      // These should match exactly.
+      t1 = high_resolution_clock::now();
+      nam::render_parallel(make_model, input.data(), parallel.data(), input.size(), (size_t)options.parallel_threads);
+      t2 = high_resolution_clock::now();
+      size_t mismatches = 0;
+      for (size_t i = 0; i < input.size(); i++)
+        if (serial[i] != parallel[i])
+          mismatches++;
+      const double parallel_ms = duration<double, std::milli>(t2 - t1).count();
+      std::cout << "Receptive field: " << model->get_receptive_field() << ", frames that differ from serial: "
+                << mismatches << "\n";
+      std::cout << "Parallel: " << parallel_ms << "ms, speedup: " << serial_ms / parallel_ms << "x\n";
+      exit(mismatches == 0 ? 0 : 1);
+    }
+
+    if (options.host_block_size > 0)
+    {
+      std::unique_ptr<nam::DSP> direct = nam::get_dsp(modelPath);
+      const int block_size = nam::RebufferingDSP::choose_block_size(*model);
+      nam::RebufferingDSP rebuffered(std::move(model), block_size);
+      std::cout << "Block size: " << block_size << ", added latency: " << rebuffered.get_latency() << " samples\n";
+      compare_speed(*direct, "Direct", rebuffered, "rebuffered", options.host_block_size);
+      exit(0);
+    }
+
     auto t1 = high_resolution_clock::now();
 
     size_t bufferSize = 64;
@@ -63,9 +471,7 @@ int main(int argc, char* argv[])
     std::cout << ms_double.count() << "ms\n";
   }
   else
-  {
-    std::cerr << "Usage: loadmodel <model_path>\n";
-  }
+    usage();
 
   exit(0);
 }
@@ -0,0 +1,44 @@
+#include <stdlib.h>
+#include <exception>
+#include <filesystem>
+
+#include "NAM/dsp.h"
+#include "NAM/model_pack.h"
+
+int main(int argc, char* argv[])
+{
+  if (argc > 2)
+  {
+    char* outputPath = argv[1];
+
+    fprintf(stderr, "Building model pack [%s] from %d models\n", outputPath, argc - 2);
+
+    try
+    {
+      nam::model_pack::PackWriter writer(outputPath);
+      for (int i = 2; i < argc; i++)
+      {
+        // Models are named after their files.
+        const std::string name = std::filesystem::path(argv[i]).stem().string();
+        // Building the model checks that the weights match the config before anything gets written.
+        nam::dspData data;
+        auto model = nam::get_dsp(argv[i], data);
+        writer.add(name, data);
+        fprintf(stderr, "  %s: %s, %zu weights\n", name.c_str(), data.architecture.c_str(), data.weights.size());
+      }
+      writer.finish();
+    }
+    catch (const std::exception& e)
+    {
+      fprintf(stderr, "Failed to build model pack: %s\n", e.what());
+
+      exit(1);
+    }
+  }
+  else
+  {
+    fprintf(stderr, "Usage: buildpack <output_path> <model_path> [<model_path> ...]\n");
+  }
+
+  exit(0);
+}
@@ -0,0 +1,39 @@
+#include <stdlib.h>
+#include <exception>
+
+#include "NAM/binary_model.h"
+#include "NAM/dsp.h"
+
+int main(int argc, char* argv[])
+{
+  if (argc > 2)
+  {
+    char* modelPath = argv[1];
+    char* outputPath = argv[2];
+
+    fprintf(stderr, "Converting model [%s] to [%s]\n", modelPath, outputPath);
+
+    try
+    {
+      // Building the model checks that the weights match the config before anything gets written, and packs them
+      // the way they're stored in the file.
+      nam::dspData data;
+      auto model = nam::get_dsp(modelPath, data);
+      nam::binary_model::save(data, outputPath, model.get());
+      fprintf(stderr, "Wrote %zu weights (%zu floats packed)\n", data.weights.size(),
+              model->get_packed_weights().size());
+    }
+    catch (const std::exception& e)
+    {
+      fprintf(stderr, "Failed to convert model: %s\n", e.what());
+
+      exit(1);
+    }
+  }
+  else
+  {
+    fprintf(stderr, "Usage: convertmodel <model_path> <output_path>\n");
+  }
+
+  exit(0);
+}
@@ -1,9 +1,64 @@
 #include <stdlib.h>
+#include <chrono>
+#include <cstring>
+#include <exception>
+
 #include "NAM/dsp.h"
+#include "NAM/model_info.h"
+
+namespace
+{
+// Describe the models without loading them. Returns whether all of them could be read.
+bool inspect(const int numModels, char* modelPaths[])
+{
+  bool ok = true;
+  const auto start = std::chrono::steady_clock::now();
+  for (int i = 0; i < numModels; i++)
+  {
+    try
+    {
+      const nam::ModelInfo info = nam::get_model_info(modelPaths[i]);
+      printf("%s\n", modelPaths[i]);
+      printf("  Architecture:    %s (version %s)\n", info.architecture.c_str(), info.version.c_str());
+      printf("  Config:          %s\n", info.config.dump().c_str());
+      if (info.expected_sample_rate > 0.0)
+        printf("  Sample rate:     %g Hz\n", info.expected_sample_rate);
+      else
+        printf("  Sample rate:     unknown\n");
+      if (info.loudness.has_value())
+        printf("  Loudness:        %g dB\n", *info.loudness);
+      if (info.receptive_field > 0)
+        printf("  Receptive field: %ld samples\n", info.receptive_field);
+      else
+        printf("  Receptive field: unbounded (recurrent)\n");
+      printf("  Weights:         %zu", info.num_weights);
+      if (info.num_weights != info.expected_num_weights)
+      {
+        printf(" (MISMATCH: the config calls for %zu)", info.expected_num_weights);
+        ok = false;
+      }
+      printf("\n");
+    }
+    catch (const std::exception& e)
+    {
+      fprintf(stderr, "Failed to inspect [%s]: %s\n", modelPaths[i], e.what());
+      ok = false;
+    }
+  }
+  const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+  fprintf(stderr, "Inspected %d models in %.2fms\n", numModels, elapsed.count());
+  return ok;
+}
+}; // namespace
 
 int main(int argc, char* argv[])
 {
-  if (argc > 1)
+  if (argc > 2 && std::strcmp(argv[1], "--inspect") == 0)
+  {
+    if (!inspect(argc - 2, argv + 2))
+      exit(1);
+  }
+  else if (argc > 1)
   {
     char* modelPath = argv[1];
 
@@ -25,6 +80,7 @@ int main(int argc, char* argv[])
   else
   {
     fprintf(stderr, "Usage: loadmodel <model_path>\n");
+    fprintf(stderr, "       loadmodel --inspect <model_path> [<model_path> ...]\n");
   }
 
   exit(0);